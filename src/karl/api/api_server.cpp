@@ -3,23 +3,38 @@
 #include <fastcgi++/manager.hpp>
 #include <karl/api/request.hpp>
 #include <karl/util/log.hpp>
+#include <karl/util/thread_pool.hpp>
+
+#include <supermarx/util/guard.hpp>
 
 namespace supermarx
 {
 
-api_server::api_server(karl &_k)
+api_server::api_server(karl &_k, size_t _workers)
 	: k(_k)
+	, workers(_workers)
 {}
 
 void api_server::run()
 {
-	log("api::api_server", log::NOTICE)() << "Starting fCGI manager";
+	log("api::api_server", log::NOTICE)() << "Starting fCGI manager with " << workers << " workers";
 
 	try
 	{
+		std::unique_ptr<thread_pool> pool;
+
 		Fastcgipp::GenManager<fcgi_request> m([&](){
-			return boost::shared_ptr<fcgi_request>(new fcgi_request(k));
+			return boost::shared_ptr<fcgi_request>(new fcgi_request(k, pool.get()));
 		});
+
+		if(workers > 0)
+			pool.reset(new thread_pool(workers));
+
+		// Finish the requests in flight while their manager is still around
+		auto g(make_guard([&]() {
+			pool.reset();
+		}));
+
 		m.handler();
 	}
 	catch(std::exception& e)
@@ -5,13 +5,18 @@
 namespace supermarx
 {
 
+/* Serves the API over FastCGI.
+ * With workers > 0 requests are answered concurrently by that many worker threads, which call into karl in parallel;
+ * with workers = 0 they are answered one at a time on the thread calling run().
+ */
 class api_server
 {
 private:
 	karl& k;
+	size_t workers;
 
 public:
-	api_server(karl& k);
+	api_server(karl& k, size_t workers = 0);
 
 	void run();
 };
@@ -4,22 +4,26 @@
 
 #include <karl/util/log.hpp>
 
+#include <fastcgi++/message.hpp>
+
 #include <supermarx/api/exception.hpp>
 #include <supermarx/util/timer.hpp>
 
 namespace supermarx
 {
 
-fcgi_request::fcgi_request(karl& _k)
+fcgi_request::fcgi_request(karl& _k, thread_pool* _workers)
 	: Request()
 	, k(_k)
+	, workers(_workers)
+	, pending()
 {}
 
-bool fcgi_request::response()
+void fcgi_request::respond(std::ostream& os)
 {
 	timer t;
 
-	request r(*this);
+	request r(environment(), os);
 	try
 	{
 		response_handler::respond(r, k);
@@ -38,12 +42,54 @@ bool fcgi_request::response()
 	}
 
 	log("api::fcgi_request", log::NOTICE)() << environment().requestUri << " [" << t.diff_msec().count() << "µs]";
+}
+
+void fcgi_request::flush(std::ostringstream const& os)
+{
+	const std::string data(os.str());
+	out.dump(data.data(), data.size());
+}
+
+bool fcgi_request::response()
+{
+	if(workers == nullptr)
+	{
+		std::ostringstream os;
+		respond(os);
+		flush(os);
+		return true;
+	}
+
+	// Called again by the manager once the worker has sent its message
+	if(pending)
+	{
+		flush(*pending);
+		pending.reset();
+		return true;
+	}
+
+	pending.reset(new std::ostringstream());
+
+	// The environment is complete and left alone by the manager from here on; the worker only writes to its own buffer.
+	// Holding on to the request keeps it alive should the manager drop it meanwhile.
+	boost::shared_ptr<fcgi_request> self(shared_from_this());
+	boost::function<void(Fastcgipp::Message)> done(callback);
+
+	workers->post([self, done]()
+	{
+		self->respond(*self->pending);
+
+		Fastcgipp::Message msg;
+		msg.type = 1;
+		done(msg);
+	});
 
-	return true;
+	return false;
 }
 
-request::request(fcgi_request &parent)
-	: fcgi(parent)
+request::request(env_t const& _e, std::ostream& _out)
+	: e(_e)
+	, out(_out)
 	, state(state_e::init)
 {}
 
@@ -52,11 +98,11 @@ void request::write_header(const std::string key, const std::string value)
 	if(state == state_e::init)
 		state = state_e::header;
 	else if(state == state_e::header)
-		fcgi.out << "\n";
+		out << "\n";
 	else
 		throw api::exception::state_unexpected;
 
-	fcgi.out << key << ": " << value;
+	out << key << ": " << value;
 }
 
 void request::write_endofheader()
@@ -65,7 +111,7 @@ void request::write_endofheader()
 		throw api::exception::state_unexpected;
 
 	state = state_e::body;
-	fcgi.out << "\r\n\r\n";
+	out << "\r\n\r\n";
 }
 
 void request::write_text(const std::string& str) const
@@ -73,7 +119,7 @@ void request::write_text(const std::string& str) const
 	if(state != state_e::body)
 		throw api::exception::state_unexpected;
 
-	fcgi.out << str;
+	out << str;
 }
 
 void request::write_bytes(const char *data, size_t size) const
@@ -81,12 +127,12 @@ void request::write_bytes(const char *data, size_t size) const
 	if(state != state_e::body)
 		throw api::exception::state_unexpected;
 
-	fcgi.out.dump(data, size);
+	out.write(data, size);
 }
 
 const request::env_t& request::env() const
 {
-	return fcgi.environment();
+	return e;
 }
 
 }
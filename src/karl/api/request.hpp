@@ -1,20 +1,36 @@
 #pragma once
 
+#include <memory>
+#include <sstream>
+
+#include <boost/enable_shared_from_this.hpp>
+
 #include <fastcgi++/request.hpp>
 #include <karl/karl.hpp>
+#include <karl/util/thread_pool.hpp>
 
 namespace supermarx
 {
 
-class fcgi_request : public Fastcgipp::Request<char>
+/* A single FastCGI request.
+ * Without workers the response is produced on the thread of the FastCGI manager, blocking all other requests meanwhile.
+ * With workers the response is produced on a worker thread, into a buffer that is handed to the manager thread when done.
+ */
+class fcgi_request : public Fastcgipp::Request<char>, public boost::enable_shared_from_this<fcgi_request>
 {
 	karl& k;
+	thread_pool* workers;
+
+	std::unique_ptr<std::ostringstream> pending;
+
+	void respond(std::ostream& os);
+	void flush(std::ostringstream const& os);
 
 public:
 	fcgi_request(fcgi_request&) = delete;
 	void operator=(fcgi_request&) = delete;
 
-	fcgi_request(karl& k);
+	fcgi_request(karl& k, thread_pool* workers);
 
 	bool response();
 };
@@ -33,14 +49,15 @@ private:
 		done
 	};
 
-	fcgi_request& fcgi;
+	env_t const& e;
+	std::ostream& out;
 	state_e state;
 
 public:
 	request(request&) = delete;
 	void operator=(request&) = delete;
 
-	request(fcgi_request& parent);
+	request(env_t const& e, std::ostream& out);
 
 	void write_header(const std::string key, const std::string value);
 	void write_endofheader();
@@ -215,6 +215,24 @@ bool process(request& r, response_handler::serializer_ptr& s, karl& k, const uri
 		return true;
 	}
 
+	if(u.match_path(0, "add_products"))
+	{
+		require_permissions(r, k);
+
+		if(u.path.size() != 2)
+			return false;
+
+		id_t supermarket_id = boost::lexical_cast<id_t>(u.path[1]);
+		std::vector<message::add_product> request = deserialize_payload<std::vector<message::add_product>>(r, "add_products");
+
+		std::vector<std::string> statuses;
+		for(storage::add_product_result result : k.add_products(supermarket_id, request))
+			statuses.emplace_back(to_string(result));
+
+		serialize(s, "statuses", statuses);
+		return true;
+	}
+
 	if(u.match_path(0, "add_product_image_citation"))
 	{
 		require_permissions(r, k);
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+
+#include <supermarx/message/product_summary.hpp>
+
+namespace supermarx
+{
+
+/* Inverted index over the products of a single supermarket catalog.
+ * Used to block the cross-supermarket matching: instead of scoring a product against every product of a catalog,
+ * only the products sharing a name token, a name token prefix or the exact volume are yielded as candidates.
+ */
+class candidate_index
+{
+public:
+	struct options
+	{
+		size_t max_candidates; // Maximum number of candidates yielded per query
+		size_t prefix_length; // Length of the token prefixes, which catch inflections ("aardappel" vs "aardappelen")
+		float max_key_frequency; // Keys occurring in a larger fraction of the catalog are not discriminative, and ignored
+	};
+
+	static inline options default_options()
+	{
+		return options({100, 4, 0.1f});
+	}
+
+private:
+	typedef std::vector<size_t> postings_t;
+	typedef std::pair<measure, decltype(message::product_summary::volume)> volume_key_t;
+
+	options opt;
+	size_t size;
+	size_t max_postings;
+
+	std::unordered_map<std::string, postings_t> tokens;
+	std::unordered_map<std::string, postings_t> prefixes;
+	std::map<volume_key_t, postings_t> volumes;
+
+	enum class key_e
+	{
+		TOKEN,
+		PREFIX,
+		VOLUME
+	};
+
+	static inline size_t weight(key_e k)
+	{
+		switch(k)
+		{
+		case key_e::TOKEN:
+			return 2;
+		case key_e::PREFIX:
+		case key_e::VOLUME:
+			return 1;
+		}
+
+		return 0;
+	}
+
+	template<typename F>
+	inline void keys(std::string const& name, F f) const
+	{
+		std::string const name_lower(boost::to_lower_copy(name));
+
+		std::vector<std::string> xs;
+		boost::split(xs, name_lower, boost::is_any_of(" "));
+
+		std::sort(xs.begin(), xs.end());
+		xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+
+		std::vector<std::string> ps;
+		for(std::string const& x : xs)
+		{
+			if(x.empty())
+				continue;
+
+			f(key_e::TOKEN, x);
+			ps.emplace_back(x.substr(0, opt.prefix_length));
+		}
+
+		std::sort(ps.begin(), ps.end());
+		ps.erase(std::unique(ps.begin(), ps.end()), ps.end());
+
+		for(std::string const& p : ps)
+			f(key_e::PREFIX, p);
+	}
+
+	static inline volume_key_t volume_key(message::product_summary const& p)
+	{
+		return volume_key_t(p.volume_measure, p.volume);
+	}
+
+public:
+	candidate_index(std::vector<message::product_summary> const& products, options const& _opt = default_options())
+	: opt(_opt)
+	, size(products.size())
+	, max_postings(std::max<size_t>(opt.max_candidates, opt.max_key_frequency * products.size()))
+	, tokens()
+	, prefixes()
+	, volumes()
+	{
+		for(size_t i = 0; i < products.size(); ++i)
+		{
+			keys(products[i].name, [&](key_e k, std::string const& key)
+			{
+				(k == key_e::TOKEN ? tokens : prefixes)[key].emplace_back(i);
+			});
+
+			volumes[volume_key(products[i])].emplace_back(i);
+		}
+	}
+
+	/* Yields the indices (into the indexed catalog) of the products worth scoring against x,
+	 * ordered from most to least overlapping, and at most max_candidates long.
+	 */
+	std::vector<size_t> candidates(message::product_summary const& x) const
+	{
+		std::vector<size_t> hits(size, 0);
+		std::vector<size_t> touched;
+
+		auto visit_f([&](postings_t const& postings, size_t w)
+		{
+			if(postings.size() > max_postings)
+				return;
+
+			for(size_t i : postings)
+			{
+				if(hits[i] == 0)
+					touched.emplace_back(i);
+
+				hits[i] += w;
+			}
+		});
+
+		keys(x.name, [&](key_e k, std::string const& key)
+		{
+			auto const& map(k == key_e::TOKEN ? tokens : prefixes);
+
+			auto it = map.find(key);
+			if(it != map.end())
+				visit_f(it->second, weight(k));
+		});
+
+		{
+			auto it = volumes.find(volume_key(x));
+			if(it != volumes.end())
+				visit_f(it->second, weight(key_e::VOLUME));
+		}
+
+		auto cmp_f([&](size_t a, size_t b) {
+			if(hits[a] != hits[b])
+				return hits[a] > hits[b];
+
+			return a < b;
+		});
+
+		if(touched.size() > opt.max_candidates)
+		{
+			std::nth_element(touched.begin(), touched.begin() + opt.max_candidates, touched.end(), cmp_f);
+			touched.resize(opt.max_candidates);
+		}
+
+		std::sort(touched.begin(), touched.end(), cmp_f);
+		return touched;
+	}
+};
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include <supermarx/id_t.hpp>
+#include <supermarx/message/product_summary.hpp>
+
+#include <karl/candidate_index.hpp>
+#include <karl/prepared_product.hpp>
+
+namespace supermarx
+{
+
+/* Immutable in-memory snapshot of the products of a single supermarket.
+ * Loaded once per matching run, after which every comparison is made against the snapshot instead of the database.
+ */
+class catalog
+{
+private:
+	reference<data::supermarket> _supermarket_id;
+	std::vector<message::product_summary> _products;
+	std::vector<prepared_product> _prepared;
+	candidate_index _index;
+
+public:
+	/* The tokens of all catalogs that are to be compared with each other must be interned in the same pool */
+	catalog(reference<data::supermarket> supermarket_id, std::vector<message::product_summary>&& products, token_pool& pool)
+	: _supermarket_id(supermarket_id)
+	, _products(std::move(products))
+	, _prepared()
+	, _index(_products)
+	{
+		_prepared.reserve(_products.size());
+		for(message::product_summary const& p : _products)
+			_prepared.emplace_back(p, pool);
+	}
+
+	reference<data::supermarket> supermarket_id() const
+	{
+		return _supermarket_id;
+	}
+
+	std::vector<message::product_summary> const& products() const
+	{
+		return _products;
+	}
+
+	/* The products prepared for similarity, in the same order as products() */
+	std::vector<prepared_product> const& prepared() const
+	{
+		return _prepared;
+	}
+
+	candidate_index const& index() const
+	{
+		return _index;
+	}
+};
+
+}
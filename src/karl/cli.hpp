@@ -5,6 +5,7 @@
 #include <karl/karl.hpp>
 #include <karl/config.hpp>
 #include <karl/api/api_server.hpp>
+#include <karl/util/log.hpp>
 
 #include <supermarx/api/session_operations.hpp>
 
@@ -21,6 +22,10 @@ private:
 		std::string config;
 		bool no_perms;
 		std::string action;
+
+		id_t base_supermarket;
+		std::vector<id_t> slave_supermarkets;
+		size_t threads;
 	};
 
 	static int read_options(cli_options& opt, int argc, char** argv)
@@ -31,6 +36,12 @@ private:
 				("config,C", boost::program_options::value(&opt.config), "path to the configfile (default: ./config.yaml)")
 				("no-perms,n", "do not check permissions");
 
+		boost::program_options::options_description o_match("Matching options");
+		o_match.add_options()
+				("base,b", boost::program_options::value(&opt.base_supermarket)->default_value(1), "supermarket to match the other supermarkets against")
+				("slaves,s", boost::program_options::value(&opt.slave_supermarkets)->multitoken()->default_value({2, 3, 4, 5}, "2 3 4 5"), "supermarkets to match against the base supermarket")
+				("threads,j", boost::program_options::value(&opt.threads)->default_value(0), "number of threads to score with (default: one per core)");
+
 		boost::program_options::variables_map vm;
 		boost::program_options::positional_options_description pos;
 
@@ -38,6 +49,7 @@ private:
 
 		boost::program_options::options_description options("Allowed options");
 		options.add(o_general);
+		options.add(o_match);
 		options.add_options()
 				("action", boost::program_options::value(&opt.action));
 
@@ -69,8 +81,19 @@ private:
 					<< "  create-user           create an user" << std::endl
 					<< "  server [-n]           serve the REST API server via fastcgi" << std::endl
 					<< "                            use a wrapper like `spawn-fcgi`" << std::endl
+					<< "  match [-b] [-s] [-j]  merge the productclasses of similar products" << std::endl
+					<< "                            across supermarkets" << std::endl
+					<< "  match-recall [-b] [-s]  report the recall of the candidate index" << std::endl
+					<< "                            against exhaustive matching" << std::endl
+					<< "  check-integrity       check the consistency of the entire tag tree" << std::endl
+					<< "  compact               fold repeated sightings of unchanged prices" << std::endl
+					<< "                            into runs" << std::endl
+					<< "  expire-productlog     drop or archive the productlog partitions" << std::endl
+					<< "                            older than retention.productlog_months" << std::endl
+					<< std::endl
+					<< o_general
 					<< std::endl
-					<< o_general;
+					<< o_match;
 
 			return EXIT_FAILURE;
 		}
@@ -101,13 +124,21 @@ public:
 			return result;
 
 		supermarx::config c(opt.config);
-		supermarx::karl karl(c.db_host, c.db_user, c.db_password, c.db_database, c.ic_path, !opt.no_perms);
-
-		karl.check_integrity();
+		supermarx::karl karl(c.db_host, c.db_user, c.db_password, c.db_database, c.db_pool_size, c.ic_path, !opt.no_perms);
 
 		if(opt.action == "server")
 		{
-			supermarx::api_server as(karl);
+			if(c.api_workers > c.db_pool_size)
+				log("cli", log::WARNING)() << "Using more API workers (" << c.api_workers << ") than database connections (" << c.db_pool_size << "), workers will wait on each other";
+
+			if(c.ingest_async)
+				karl.enable_async_ingest(c.ingest_queue_size, c.ingest_batch_size, std::chrono::milliseconds(c.ingest_max_delay_ms));
+
+			// The server is usually killed rather than stopped, so the statistics would otherwise never be logged
+			if(c.db_stats_interval_s > 0)
+				karl.enable_statement_stats(std::chrono::seconds(c.db_stats_interval_s));
+
+			supermarx::api_server as(karl, c.api_workers);
 			as.run();
 		}
 		else if(opt.action == "create-user")
@@ -135,9 +166,31 @@ public:
 						  << password << std::endl
 						  << std::endl;
 		}
-		else if(opt.action == "test")
+		else if(opt.action == "match")
+		{
+			karl.match(opt.base_supermarket, {opt.slave_supermarkets.begin(), opt.slave_supermarkets.end()}, opt.threads);
+		}
+		else if(opt.action == "match-recall")
 		{
-			karl.test();
+			karl.match_recall(opt.base_supermarket, {opt.slave_supermarkets.begin(), opt.slave_supermarkets.end()});
+		}
+		else if(opt.action == "check-integrity")
+		{
+			karl.check_integrity();
+		}
+		else if(opt.action == "compact")
+		{
+			karl.compact();
+		}
+		else if(opt.action == "expire-productlog")
+		{
+			if(c.retention_productlog_months == 0)
+			{
+				std::cerr << "No retention.productlog_months configured, the productlog is kept forever." << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			karl.expire_productlog(c.retention_productlog_months, c.retention_productlog_archive);
 		}
 		else
 		{
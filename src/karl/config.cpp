@@ -15,10 +15,28 @@ config::config(std::string const& filename)
 	db_user = db["user"].as<std::string>();
 	db_password = db["password"].as<std::string>();
 	db_database = db["database"].as<std::string>();
+	db_pool_size = db["pool_size"] ? db["pool_size"].as<size_t>() : 4;
+	db_stats_interval_s = db["stats_interval_s"] ? db["stats_interval_s"].as<size_t>() : 3600;
 
 	const YAML::Node& ic = doc["imagecitations"];
 
 	ic_path = ic["path"].as<std::string>();
+
+	const YAML::Node& api = doc["api"];
+
+	api_workers = (api && api["workers"]) ? api["workers"].as<size_t>() : 4;
+
+	const YAML::Node& ingest = doc["ingest"];
+
+	ingest_async = (ingest && ingest["async"]) ? ingest["async"].as<bool>() : false;
+	ingest_queue_size = (ingest && ingest["queue_size"]) ? ingest["queue_size"].as<size_t>() : 10000;
+	ingest_batch_size = (ingest && ingest["batch_size"]) ? ingest["batch_size"].as<size_t>() : 500;
+	ingest_max_delay_ms = (ingest && ingest["max_delay_ms"]) ? ingest["max_delay_ms"].as<size_t>() : 100;
+
+	const YAML::Node& retention = doc["retention"];
+
+	retention_productlog_months = (retention && retention["productlog_months"]) ? retention["productlog_months"].as<size_t>() : 0;
+	retention_productlog_archive = (retention && retention["productlog_archive"]) ? retention["productlog_archive"].as<std::string>() : "";
 }
 
 }
@@ -9,7 +9,14 @@ class config
 {
 public:
 	std::string db_host, db_user, db_password, db_database;
+	size_t db_pool_size;
+	size_t db_stats_interval_s; // 0 only logs the statement statistics upon shutdown
 	std::string ic_path;
+	size_t api_workers;
+	bool ingest_async;
+	size_t ingest_queue_size, ingest_batch_size, ingest_max_delay_ms;
+	size_t retention_productlog_months; // 0 keeps the productlog forever
+	std::string retention_productlog_archive; // Schema to move expired partitions into; dropped when empty
 
 	config(std::string const& filename);
 };
@@ -0,0 +1,210 @@
+#include <karl/ingest_queue.hpp>
+
+#include <map>
+#include <stdexcept>
+
+#include <pqxx/pqxx>
+
+#include <karl/util/log.hpp>
+
+namespace supermarx
+{
+
+ingest_queue::ingest_queue(storage& _backend, size_t _capacity, size_t _max_batch, std::chrono::milliseconds _max_delay)
+	: backend(_backend)
+	, capacity(std::max<size_t>(_capacity, 1))
+	, max_batch(std::max<size_t>(std::min(_max_batch, capacity), 1))
+	, max_delay(_max_delay)
+	, m()
+	, cv_work()
+	, cv_room()
+	, entries()
+	, stopping(false)
+	, stats_current({0, 0, 0, 0, 0, 0, 0, 0, 0})
+	, writer()
+{
+	writer = std::thread([this]() { run(); });
+}
+
+ingest_queue::~ingest_queue()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+	}
+
+	cv_work.notify_all();
+	writer.join();
+
+	stats_t s(stats());
+	log("karl::ingest_queue", log::level_e::NOTICE)() << "Flushed ingest queue: " << s.written << " products written in " << s.batches << " batches (max. " << s.max_batch_size << "), "
+		<< s.failed << " failed, " << s.retries << " retries, " << s.fallbacks << " batches written product by product, " << s.blocked << " producers blocked on a full queue";
+}
+
+void ingest_queue::push(reference<data::supermarket> supermarket_id, message::add_product const& ap)
+{
+	if(ap.p.identifier.empty())
+		throw std::invalid_argument("Product has no identifier");
+
+	if(ap.p.name.empty())
+		throw std::invalid_argument("Product " + ap.p.identifier + " has no name");
+
+	{
+		std::unique_lock<std::mutex> lock(m);
+
+		if(entries.size() >= capacity)
+		{
+			++stats_current.blocked;
+			cv_room.wait(lock, [&]() { return entries.size() < capacity; });
+		}
+
+		entries.push_back(entry_t({supermarket_id.unseal(), ap, std::chrono::steady_clock::now()}));
+		++stats_current.queued;
+	}
+
+	cv_work.notify_one();
+}
+
+ingest_queue::stats_t ingest_queue::stats() const
+{
+	std::lock_guard<std::mutex> lock(m);
+
+	stats_t s(stats_current);
+	s.depth = entries.size();
+	return s;
+}
+
+void ingest_queue::run()
+{
+	std::unique_lock<std::mutex> lock(m);
+
+	while(true)
+	{
+		cv_work.wait(lock, [&]() { return stopping || !entries.empty(); });
+
+		if(entries.empty())
+			return; // Stopping, and nothing left to write
+
+		// Give the batch the time to fill up, unless it already waited long enough
+		const auto deadline = entries.front().queued_on + max_delay;
+		cv_work.wait_until(lock, deadline, [&]() { return stopping || entries.size() >= max_batch; });
+
+		const size_t n = std::min(entries.size(), max_batch);
+		std::vector<entry_t> batch(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.begin() + n));
+		entries.erase(entries.begin(), entries.begin() + n);
+
+		const size_t depth = entries.size();
+
+		lock.unlock();
+		cv_room.notify_all();
+
+		write(batch);
+
+		lock.lock();
+
+		++stats_current.batches;
+		stats_current.max_batch_size = std::max<uint64_t>(stats_current.max_batch_size, n);
+
+		log("karl::ingest_queue", log::level_e::DEBUG)() << "Wrote batch of " << n << " products, " << depth << " were left queued";
+	}
+}
+
+/* Calls f, and again after a pause when it fails on a deadlock, serialization failure or lost connection.
+ * Any other exception, or the last transient one, is passed on.
+ */
+template<typename F>
+void ingest_queue::with_retries(F f)
+{
+	static const size_t max_attempts = 4;
+	std::chrono::milliseconds pause(50);
+
+	for(size_t attempt = 1;; ++attempt)
+	{
+		try
+		{
+			f();
+			return;
+		}
+		catch(pqxx::transaction_rollback& e)
+		{
+			if(attempt == max_attempts)
+				throw;
+
+			log("karl::ingest_queue", log::level_e::WARNING)() << "Retrying write: " << e.what();
+		}
+		catch(pqxx::broken_connection& e)
+		{
+			if(attempt == max_attempts)
+				throw;
+
+			log("karl::ingest_queue", log::level_e::WARNING)() << "Retrying write: " << e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m);
+			++stats_current.retries;
+		}
+
+		std::this_thread::sleep_for(pause);
+		pause *= 2;
+	}
+}
+
+void ingest_queue::write(std::vector<entry_t>& batch)
+{
+	// storage::add_products ignores all but the first sighting of an identifier in a call.
+	// Later sightings go into later calls instead, such that they are written in the order they were queued.
+	std::map<id_t, std::vector<std::vector<message::add_product>>> calls;
+	std::map<std::pair<id_t, std::string>, size_t> sightings;
+
+	for(entry_t& e : batch)
+	{
+		std::vector<std::vector<message::add_product>>& sm_calls(calls[e.supermarket_id]);
+		const size_t i = sightings[std::make_pair(e.supermarket_id, e.ap.p.identifier)]++;
+
+		if(sm_calls.size() <= i)
+			sm_calls.resize(i + 1);
+
+		sm_calls[i].emplace_back(std::move(e.ap));
+	}
+
+	for(auto const& sm_calls : calls)
+		for(std::vector<message::add_product> const& aps : sm_calls.second)
+		{
+			try
+			{
+				with_retries([&]() { backend.add_products(sm_calls.first, aps); });
+
+				std::lock_guard<std::mutex> lock(m);
+				stats_current.written += aps.size();
+				continue;
+			}
+			catch(std::exception& e)
+			{
+				log("karl::ingest_queue", log::level_e::WARNING)() << "Could not write " << aps.size() << " products for supermarket " << sm_calls.first << " at once, writing them one by one: " << e.what();
+
+				std::lock_guard<std::mutex> lock(m);
+				++stats_current.fallbacks;
+			}
+
+			// The producers were told these products were accepted; only give up on those that fail by themselves
+			for(message::add_product const& ap : aps)
+				try
+				{
+					// Through add_products rather than add_product, which leaves binding the tags to karl
+					with_retries([&]() { backend.add_products(sm_calls.first, {ap}); });
+
+					std::lock_guard<std::mutex> lock(m);
+					++stats_current.written;
+				}
+				catch(std::exception& e)
+				{
+					log("karl::ingest_queue", log::level_e::ERROR)() << "Could not write product " << ap.p.identifier << " for supermarket " << sm_calls.first << ": " << e.what();
+
+					std::lock_guard<std::mutex> lock(m);
+					++stats_current.failed;
+				}
+		}
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+#include <supermarx/id_t.hpp>
+#include <supermarx/message/add_product.hpp>
+
+#include <karl/storage/storage.hpp>
+
+namespace supermarx
+{
+
+/* Bounded queue of products to be added, written to storage in the background.
+ * A single writer takes up to max_batch products at a time and adds them with storage::add_products (group commit).
+ * It waits at most max_delay after the oldest queued product for a batch to fill up.
+ * push blocks while the queue is full; the destructor blocks until every queued product has been written.
+ * Writes that fail transiently are retried; a batch that keeps failing is written product by product,
+ * such that only the products that can not be written at all are lost.
+ */
+class ingest_queue
+{
+public:
+	struct stats_t
+	{
+		size_t depth; // Products queued at this moment
+		uint64_t queued, written, failed; // Products in total
+		uint64_t batches, max_batch_size;
+		uint64_t blocked; // Calls to push that had to wait for room
+		uint64_t retries; // Writes repeated after a transient error
+		uint64_t fallbacks; // Batches written product by product after a failure
+	};
+
+private:
+	struct entry_t
+	{
+		id_t supermarket_id;
+		message::add_product ap;
+		std::chrono::steady_clock::time_point queued_on;
+	};
+
+	storage& backend;
+
+	const size_t capacity;
+	const size_t max_batch;
+	const std::chrono::milliseconds max_delay;
+
+	mutable std::mutex m;
+	std::condition_variable cv_work, cv_room;
+	std::deque<entry_t> entries;
+	bool stopping;
+	stats_t stats_current;
+
+	std::thread writer;
+
+	void run();
+	void write(std::vector<entry_t>& batch);
+
+	template<typename F>
+	void with_retries(F f);
+
+public:
+	ingest_queue(ingest_queue&) = delete;
+	void operator=(ingest_queue&) = delete;
+
+	ingest_queue(storage& backend, size_t capacity, size_t max_batch, std::chrono::milliseconds max_delay);
+	~ingest_queue();
+
+	/* Throws std::invalid_argument for a product that can not be written; errors while writing are only logged */
+	void push(reference<data::supermarket> supermarket_id, message::add_product const& ap);
+
+	stats_t stats() const;
+};
+
+}
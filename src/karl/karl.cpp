@@ -1,18 +1,28 @@
 #include <karl/karl.hpp>
 
+#include <map>
+#include <chrono>
 #include <iostream>
+#include <numeric>
+
+#include <boost/date_time/gregorian/gregorian_types.hpp>
 
 #include <karl/util/log.hpp>
 #include <karl/similarity.hpp>
+#include <karl/catalog.hpp>
+#include <karl/util/thread_pool.hpp>
+#include <karl/util/top_k.hpp>
 
 #include <supermarx/api/exception.hpp>
 #include <supermarx/api/session_operations.hpp>
 
 namespace supermarx {
-	karl::karl(std::string const& host, std::string const& user, std::string const& password, const std::string& db, const std::string& imagecitation_path, bool _check_perms)
-		: backend(host, user, password, db)
+	karl::karl(std::string const& host, std::string const& user, std::string const& password, const std::string& db, size_t db_pool_size, const std::string& imagecitation_path, bool _check_perms)
+		: backend(host, user, password, db, db_pool_size)
 		, ic(imagecitation_path)
 		, check_perms(_check_perms)
+		, ingest()
+		, statement_stats()
 	{}
 
 	void karl::check_integrity()
@@ -21,6 +31,35 @@ namespace supermarx {
 		log("karl::check_integrity", log::level_e::NOTICE)() << "Database integrity checked";
 	}
 
+	void karl::compact()
+	{
+		storage::compact_result r(backend.compact_productdetailsrecords());
+		log("karl::compact", log::level_e::NOTICE)() << "Folded " << r.deleted << " productdetailsrecords into " << r.runs << " runs";
+	}
+
+	void karl::expire_productlog(size_t months, std::string const& archive_schema)
+	{
+		const date cutoff(datetime_now().date() - boost::gregorian::months(months));
+		boost::optional<std::string> archive;
+		if(!archive_schema.empty())
+			archive = archive_schema;
+
+		size_t expired = backend.expire_productlog(datetime(cutoff), archive);
+		log("karl::expire_productlog", log::level_e::NOTICE)() << (archive ? "Archived " : "Dropped ") << expired << " productlog partitions from before " << to_string(cutoff);
+	}
+
+	void karl::enable_async_ingest(size_t queue_size, size_t batch_size, std::chrono::milliseconds max_delay)
+	{
+		ingest.reset(new ingest_queue(backend, queue_size, batch_size, max_delay));
+		log("karl::enable_async_ingest", log::level_e::NOTICE)() << "Queueing up to " << queue_size << " products, written in batches of up to " << batch_size << " products every " << max_delay.count() << "ms";
+	}
+
+	void karl::enable_statement_stats(std::chrono::seconds interval)
+	{
+		statement_stats.reset(new periodic([this]() { backend.log_statement_stats(); }, interval));
+		log("karl::enable_statement_stats", log::level_e::NOTICE)() << "Logging statement statistics every " << interval.count() << "s";
+	}
+
 	bool karl::check_permissions() const
 	{
 		return check_perms;
@@ -127,6 +166,13 @@ namespace supermarx {
 	void karl::add_product(reference<data::supermarket> supermarket_id, message::add_product const& ap)
 	{
 		log("karl::karl", log::level_e::DEBUG)() << "Received product " << ap.p.name << " [" << supermarket_id << "] [" << ap.p.identifier << "]";
+
+		if(ingest)
+		{
+			ingest->push(supermarket_id, ap);
+			return;
+		}
+
 		backend.add_product(supermarket_id, ap);
 
 		message::product_summary ps = backend.get_product(ap.p.identifier, supermarket_id);
@@ -137,6 +183,12 @@ namespace supermarx {
 		}
 	}
 
+	std::vector<storage::add_product_result> karl::add_products(reference<data::supermarket> supermarket_id, std::vector<message::add_product> const& aps)
+	{
+		log("karl::karl", log::level_e::DEBUG)() << "Received batch of " << aps.size() << " products [" << supermarket_id << "]";
+		return backend.add_products(supermarket_id, aps);
+	}
+
 	void karl::add_product_image_citation(reference<data::supermarket> supermarket_id, const std::string &product_identifier, const std::string &original_uri, const std::string &source_uri, const datetime &retrieved_on, raw const& image)
 	{
 		std::pair<int, int> orig_geo(ic.get_size(image));
@@ -194,76 +246,202 @@ namespace supermarx {
 		backend.absorb_productclass(src_productclass_id, dest_productclass_id);
 	}
 
-	void karl::test()
+	typedef std::tuple<size_t, similarity::valuation, float> scored_t;
+
+	// Pairs need to score above this to be matched
+	static const float match_threshold = 0.5f;
+
+	struct scored_greater
 	{
-		id_t base_supermarket = 1;
-		std::vector<id_t> slave_supermarkets = {2, 3, 4, 5};
+		bool operator()(scored_t const& a, scored_t const& b) const
+		{
+			if(std::get<2>(a) != std::get<2>(b))
+				return std::get<2>(a) > std::get<2>(b);
 
-		std::map<reference<data::supermarket>, std::vector<message::product_summary>> map_supermarket_products;
+			return std::get<0>(a) < std::get<0>(b);
+		}
+	};
+
+	/* The k best scoring candidates that score above threshold, best first */
+	static std::vector<scored_t> score_candidates(prepared_product const& xps, std::vector<prepared_product> const& vps, std::vector<size_t> const& candidates, float threshold, size_t k = 1)
+	{
+		top_k<scored_t, scored_greater> best(k);
 
-		auto fetch_supermarket_f([&](reference<data::supermarket> supermarket_id)
+		// Candidates that can not reach the threshold or the k-th best score so far are only scored far enough to know they are worse
+		for(size_t i : candidates)
 		{
-			map_supermarket_products.emplace(std::make_pair(supermarket_id, backend.get_products(supermarket_id)));
-		});
+			const float min_score = best.full() ? std::max(threshold, std::get<2>(best.back())) : threshold;
 
-		fetch_supermarket_f(base_supermarket);
-		for(reference<data::supermarket> slave_supermarket_id : slave_supermarkets)
-			fetch_supermarket_f(slave_supermarket_id);
+			similarity::valuation v(similarity::exec(xps, vps[i], min_score));
+			float score = v.collapse();
 
-		auto const x_tup(map_supermarket_products.at(base_supermarket));
-		for(message::product_summary const& xps : x_tup)
+			if(score > threshold)
+				best.push(scored_t(i, v, score));
+		}
+
+		return best.release();
+	}
+
+	void karl::match(reference<data::supermarket> base_supermarket_id, std::vector<reference<data::supermarket>> const& slave_supermarket_ids, size_t threads)
+	{
+		typedef std::chrono::steady_clock clock_t;
+		clock_t::duration load_time(0);
+
+		token_pool pool;
+		auto load_f([&](reference<data::supermarket> supermarket_id)
 		{
-			//message::product_summary xps(backend.get_product("wi210145", 1));
+			clock_t::time_point start(clock_t::now());
+			catalog c(supermarket_id, backend.get_products(supermarket_id), pool);
+			load_time += clock_t::now() - start;
 
-			std::cout << "Comparing " << xps.name << " " << xps.orig_price << " " << xps.volume << std::endl;
+			return c;
+		});
 
-			for(id_t supermarket_id : slave_supermarkets)
-			{
-				std::cout << "Supermarket " << supermarket_id << std::endl;
+		catalog const base(load_f(base_supermarket_id));
+
+		std::vector<catalog> slaves;
+		slaves.reserve(slave_supermarket_ids.size());
+		for(reference<data::supermarket> slave_supermarket_id : slave_supermarket_ids)
+			slaves.emplace_back(load_f(slave_supermarket_id));
 
-				std::vector<message::product_summary> vps(backend.get_products(supermarket_id));
+		std::vector<message::product_summary> const& x_tup(base.products());
 
-				typedef std::tuple<size_t, similarity::valuation, float> tup_t;
-				std::vector<tup_t> rps;
-				rps.reserve(vps.size());
+		// Score all (base product, slave supermarket) pairs in parallel, keeping only the best accepted candidate of each
+		std::vector<boost::optional<scored_t>> best(x_tup.size() * slaves.size());
+		std::vector<char> had_candidates(x_tup.size() * slaves.size(), 0); // Not vector<bool>, which is unsafe to write from several threads
+		std::vector<size_t> comparisons(x_tup.size(), 0);
 
+		clock_t::time_point score_start(clock_t::now());
+		size_t pool_size;
+		{
+			thread_pool pool(threads);
+			pool_size = pool.size();
+
+			pool.parallel_for(x_tup.size(), [&](size_t xi)
+			{
+				message::product_summary const& xps(x_tup[xi]);
+
+				for(size_t si = 0; si < slaves.size(); ++si)
 				{
-					size_t i = 0;
-					for(auto const& yps : vps)
-					{
-						similarity::valuation v(similarity::exec(xps, yps));
-						rps.emplace_back(i, v, v.collapse());
-						++i;
-					}
+					std::vector<size_t> candidates(slaves[si].index().candidates(xps));
+					std::vector<scored_t> rps(score_candidates(base.prepared()[xi], slaves[si].prepared(), candidates, match_threshold));
+					comparisons[xi] += candidates.size();
+					had_candidates[xi * slaves.size() + si] = !candidates.empty();
+
+					if(!rps.empty())
+						best[xi * slaves.size() + si] = rps.front();
 				}
+			});
+		}
+		clock_t::duration score_time(clock_t::now() - score_start);
+
+		// The catalogs still hold the productclasses from before this run; absorbed[src] is the class src was merged into since
+		std::map<reference<data::productclass>, reference<data::productclass>> absorbed;
+		auto resolve_f([&](reference<data::productclass> productclass_id)
+		{
+			reference<data::productclass> root(productclass_id);
+			for(auto it = absorbed.find(root); it != absorbed.end(); it = absorbed.find(root))
+				root = it->second;
+
+			// Point the whole chain at its survivor, such that later lookups take a single step
+			while(productclass_id != root)
+			{
+				auto it = absorbed.find(productclass_id);
+				productclass_id = it->second;
+				it->second = root;
+			}
 
-				std::sort(rps.begin(), rps.end(), [](tup_t a, tup_t b) {
-					return std::get<2>(a) > std::get<2>(b);
-				});
+			return root;
+		});
 
-				size_t i = 0;
+		// Apply the winning pairs from a single writer, in the order a sequential run would
+		for(size_t xi = 0; xi < x_tup.size(); ++xi)
+		{
+			message::product_summary const& xps(x_tup[xi]);
+			std::cout << "Comparing " << xps.name << " " << xps.orig_price << " " << xps.volume << std::endl;
 
-				auto const& tup(rps.at(i));
-				auto const& yps(vps.at(std::get<0>(tup)));
+			for(size_t si = 0; si < slaves.size(); ++si)
+			{
+				std::cout << "Supermarket " << slaves[si].supermarket_id() << std::endl;
 
-				if(xps.productclass_id == yps.productclass_id)
+				if(!had_candidates[xi * slaves.size() + si])
+				{
+					std::cout << "No candidates" << std::endl;
 					continue;
+				}
 
-				if(std::get<2>(tup) <= 0.5)
+				boost::optional<scored_t> const& tup(best[xi * slaves.size() + si]);
+				if(!tup)
 				{
 					std::cout << "No match" << std::endl;
 					continue;
 				}
 
-				std::cout << yps.name << " " << yps.orig_price << " " << yps.volume << " [" << std::get<2>(tup) << "]";
+				auto const& yps(slaves[si].products().at(std::get<0>(*tup)));
+
+				const reference<data::productclass> x_productclass_id(resolve_f(xps.productclass_id));
+				const reference<data::productclass> y_productclass_id(resolve_f(yps.productclass_id));
+
+				if(x_productclass_id == y_productclass_id)
+					continue;
 
-				for(float v : std::get<1>(tup).data)
+				std::cout << yps.name << " " << yps.orig_price << " " << yps.volume << " [" << std::get<2>(*tup) << "]";
+
+				for(float v : std::get<1>(*tup).data)
 					std::cout << " " << std::round(100.0f*v)/100.0f;
 
 				std::cout << std::endl;
 
-				backend.absorb_productclass(yps.productclass_id, xps.productclass_id);
+				backend.absorb_productclass(y_productclass_id, x_productclass_id);
+				absorbed.emplace(y_productclass_id, x_productclass_id);
 			}
 		}
+
+		log("karl::match", log::level_e::NOTICE)()
+			<< "Loaded " << (1 + slaves.size()) << " catalogs in " << std::chrono::duration_cast<std::chrono::milliseconds>(load_time).count() << "ms, "
+			<< "scored " << std::accumulate(comparisons.begin(), comparisons.end(), size_t(0)) << " pairs in " << std::chrono::duration_cast<std::chrono::milliseconds>(score_time).count() << "ms"
+			<< " using " << pool_size << " threads";
+	}
+
+	void karl::match_recall(reference<data::supermarket> base_supermarket_id, std::vector<reference<data::supermarket>> const& slave_supermarket_ids)
+	{
+		token_pool pool;
+		catalog const base(base_supermarket_id, backend.get_products(base_supermarket_id), pool);
+
+		for(reference<data::supermarket> slave_supermarket_id : slave_supermarket_ids)
+		{
+			catalog const slave(slave_supermarket_id, backend.get_products(slave_supermarket_id), pool);
+			std::vector<message::product_summary> const& vps(slave.products());
+
+			std::vector<size_t> all_candidates(vps.size());
+			std::iota(all_candidates.begin(), all_candidates.end(), 0);
+
+			size_t queries = 0, candidates_total = 0, accepted = 0, recalled = 0;
+
+			for(size_t xi = 0; xi < base.products().size(); ++xi)
+			{
+				std::vector<size_t> candidates(slave.index().candidates(base.products()[xi]));
+
+				++queries;
+				candidates_total += candidates.size();
+
+				prepared_product const& xps(base.prepared()[xi]);
+				std::vector<scored_t> rps_exhaustive(score_candidates(xps, slave.prepared(), all_candidates, match_threshold));
+				if(rps_exhaustive.empty())
+					continue;
+
+				++accepted;
+
+				std::vector<scored_t> rps_blocked(score_candidates(xps, slave.prepared(), candidates, match_threshold));
+				if(!rps_blocked.empty() && std::get<2>(rps_blocked.front()) >= std::get<2>(rps_exhaustive.front()))
+					++recalled;
+			}
+
+			log("karl::match_recall", log::level_e::NOTICE)()
+				<< "Supermarket " << slave_supermarket_id << ": "
+				<< recalled << "/" << accepted << " accepted matches recalled"
+				<< " (" << (accepted > 0 ? 100.0f * recalled / accepted : 100.0f) << "%), "
+				<< (queries > 0 ? (float)candidates_total / queries : 0.0f) << " candidates per product out of " << vps.size();
+		}
 	}
 }
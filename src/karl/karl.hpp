@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <chrono>
 
 #include <supermarx/id_t.hpp>
 
@@ -9,18 +11,34 @@
 
 #include <karl/storage/storage.hpp>
 #include <karl/image_citations.hpp>
+#include <karl/ingest_queue.hpp>
+#include <karl/util/periodic.hpp>
 
 namespace supermarx
 {
 	/* The man who keeps an eye on all the prices.
 	 * Karl abstracts from how products and prices are stored, and provides an interface for fetching, adding and removing products.
+	 * All member functions may be called from several threads at once: karl keeps no mutable state of its own,
+	 * and every storage call runs in its own transaction on a connection checked out from the pool.
 	 */
 	class karl
 	{
 	public:
-		karl(std::string const& host, std::string const& user, std::string const& password, const std::string& db, const std::string& imagecitation_path, bool check_perms);
+		karl(std::string const& host, std::string const& user, std::string const& password, const std::string& db, size_t db_pool_size, const std::string& imagecitation_path, bool check_perms);
 
 		void check_integrity();
+		void compact();
+
+		/* Removes the productlog of the months that ended more than the given number of months ago.
+		 * Their partitions are moved into archive_schema, or dropped when it is empty.
+		 */
+		void expire_productlog(size_t months, std::string const& archive_schema);
+
+		/* From now on, add_product only validates and queues products; they are written in batches in the background */
+		void enable_async_ingest(size_t queue_size, size_t batch_size, std::chrono::milliseconds max_delay);
+
+		/* From now on, logs the statement statistics of storage every interval */
+		void enable_statement_stats(std::chrono::seconds interval);
 
 		bool check_permissions() const;
 
@@ -35,6 +53,7 @@ namespace supermarx
 		std::vector<message::product_log> get_recent_productlog(reference<data::supermarket> supermarket_id);
 
 		void add_product(reference<data::supermarket> supermarket_id, message::add_product const& ap);
+		std::vector<storage::add_product_result> add_products(reference<data::supermarket> supermarket_id, std::vector<message::add_product> const& aps);
 		void add_product_image_citation(reference<data::supermarket> supermarket_id, std::string const& product_identifier, std::string const& original_uri, std::string const& source_uri, const datetime &retrieved_on, raw const& image);
 
 		message::productclass_summary get_productclass(reference<data::productclass> productclass_id);
@@ -46,11 +65,15 @@ namespace supermarx
 		void update_tag(reference<data::tag> tag_id, data::tag const& tag);
 		void update_tag_set_parent(reference<data::tag> tag_id, boost::optional<reference<data::tag>> parent_tag_id = boost::none);
 
-		void test();
+		void match(reference<data::supermarket> base_supermarket_id, std::vector<reference<data::supermarket>> const& slave_supermarket_ids, size_t threads = 0);
+		void match_recall(reference<data::supermarket> base_supermarket_id, std::vector<reference<data::supermarket>> const& slave_supermarket_ids);
 
 	private:
 		storage backend;
 		image_citations ic;
 		bool check_perms;
+
+		std::unique_ptr<ingest_queue> ingest; // Destroyed before backend, to flush the queue into it
+		std::unique_ptr<periodic> statement_stats; // Destroyed before backend, which it reads from
 	};
 }
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <supermarx/message/product_summary.hpp>
+
+namespace supermarx
+{
+
+/* Assigns every distinct name token a small integer id.
+ * Products prepared with the same pool can compare tokens by id. Not thread-safe.
+ */
+class token_pool
+{
+private:
+	std::unordered_map<std::string, uint32_t> ids;
+
+public:
+	token_pool()
+	: ids()
+	{}
+
+	uint32_t intern(const char* data, size_t size)
+	{
+		return ids.emplace(std::string(data, size), static_cast<uint32_t>(ids.size())).first->second;
+	}
+};
+
+/* A product_summary prepared for repeated comparison by similarity.
+ * The name is lowercased and split on spaces once; the tokens are stored back to back in a single buffer.
+ */
+class prepared_product
+{
+public:
+	struct token_t
+	{
+		uint32_t offset, size;
+		uint32_t id;
+	};
+
+private:
+	std::string buffer;
+	std::vector<token_t> tokens;
+
+public:
+	decltype(message::product_summary::orig_price) orig_price;
+	decltype(message::product_summary::volume) volume;
+	measure volume_measure;
+
+	prepared_product(message::product_summary const& p, token_pool& pool)
+	: buffer(boost::to_lower_copy(p.name))
+	, tokens()
+	, orig_price(p.orig_price)
+	, volume(p.volume)
+	, volume_measure(p.volume_measure)
+	{
+		// Split like boost::split(.., boost::is_any_of(" ")) would, keeping empty tokens
+		size_t begin = 0;
+		while(true)
+		{
+			size_t end = buffer.find(' ', begin);
+			if(end == std::string::npos)
+				end = buffer.size();
+
+			tokens.push_back(token_t({
+				static_cast<uint32_t>(begin),
+				static_cast<uint32_t>(end - begin),
+				pool.intern(buffer.data() + begin, end - begin)
+			}));
+
+			if(end == buffer.size())
+				break;
+
+			begin = end + 1;
+		}
+
+		tokens.shrink_to_fit();
+	}
+
+	size_t size() const
+	{
+		return tokens.size();
+	}
+
+	token_t const& token(size_t i) const
+	{
+		return tokens[i];
+	}
+
+	const char* token_data(size_t i) const
+	{
+		return buffer.data() + tokens[i].offset;
+	}
+};
+
+}
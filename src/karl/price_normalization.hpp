@@ -44,6 +44,23 @@ public:
 			volume_measure
 		});
 	}
+
+	/* As exec, for a price already normalized by normalize_price in the database */
+	static inline normalized_price exec_normalized(uint64_t price_normalized, uint64_t volume, measure volume_measure)
+	{
+		if(volume == 0)
+			return normalized_price({
+				price_normalized,
+				1,
+				measure::UNITS
+			});
+
+		return normalized_price({
+			price_normalized,
+			canonical_volume(volume_measure),
+			volume_measure
+		});
+	}
 };
 
 }
@@ -1,12 +1,19 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
 #include <functional>
-#include <boost/algorithm/string.hpp>
 
 #include <supermarx/message/product_summary.hpp>
 
+#include <karl/prepared_product.hpp>
+
 #include <karl/util/levenshtein.hpp>
-#include <karl/util/hungarian_fast.hpp>
+#include <karl/util/assignment.hpp>
+
+#ifndef KARL_SIMILARITY_RESOLUTION
+#define KARL_SIMILARITY_RESOLUTION 65536
+#endif
 
 namespace supermarx
 {
@@ -24,21 +31,36 @@ public:
 		: data(_data)
 		{}
 
-		float collapse() const
+		static inline std::array<float, N> const& weights()
 		{
-			static constexpr std::array<float, N> weights = {
-				0.6f, 0.2f, 0.2f
+			static const std::array<float, N> w = {
+				{0.6f, 0.2f, 0.2f}
 			};
 
+			return w;
+		}
+
+		float collapse() const
+		{
 			float similarity = 0.0f;
 
 			for(size_t i = 0; i < N; ++i)
-				similarity += weights[i] * data[i];
+				similarity += weights()[i] * data[i];
 
 			return similarity;
 		}
 	};
 
+	/* Word pair similarities are quantized to multiples of 1 / resolution before they are assigned.
+	 * The assignment then works on exact integer costs, which rules out the extra rounds (or endless loops)
+	 * that rounding errors in floating point zero tests could cause.
+	 * The textual similarity is still summed from the unquantized similarities of the chosen word pairs.
+	 * The chosen assignment is at most 1 / resolution per word pair short of the best one, so the
+	 * textual similarity is at most 1 / resolution below that of an exact solver, and a collapsed
+	 * valuation at most 0.6 / resolution.
+	 */
+	static constexpr int32_t resolution = KARL_SIMILARITY_RESOLUTION;
+
 private:
 	template<typename T>
 	static inline float max_set(std::vector<T> const& xs, std::function<float(T const&)> f)
@@ -51,45 +73,94 @@ private:
 		return result;
 	}
 
-	static inline float textual_compare(std::string const& x, std::string const& y)
+	/* Textual similarity between the words of x and y.
+	 * When the similarity can not reach min_similarity the result is merely guaranteed to be below min_similarity,
+	 * which allows skipping most of the work for hopeless word pairs.
+	 */
+	static inline float textual_compare(prepared_product const& x, prepared_product const& y, float min_similarity = 0.0f)
 	{
-		std::vector<std::string> xs, ys;
-		boost::split(xs, x, boost::is_any_of(" "));
-		boost::split(ys, y, boost::is_any_of(" "));
+		prepared_product const* xs = &x;
+		prepared_product const* ys = &y;
 
-		if(xs.size() > ys.size())
+		if(xs->size() > ys->size())
 			std::swap(xs, ys);
 
+		float sim_min = std::min(ys->size(), xs->size()); // Due to std::swap ys->size() will always be bigger, Hungarian will thus always yield xs->size() elements
+		float sim_max = std::max(ys->size(), xs->size());
+
+		// A matching reaching min_similarity can only contain word pairs that are at least this similar;
+		// the similarity of all other pairs is irrelevant and may be underestimated as 0
+		const float sum_required = min_similarity / (0.9f / sim_min + 0.1f / sim_max);
+		const float pair_floor = sum_required - (sim_min - 1.0f);
+
 		typedef float sim_t;
-		similarity_matrix<sim_t> sm(ys.size(), xs.size());
-		for(size_t yi = 0; yi < ys.size(); ++yi)
+		thread_local similarity_matrix<sim_t> sm(0, 0);
+		sm.reset(ys->size(), xs->size());
+
+		typedef int32_t cost_t;
+		thread_local similarity_matrix<cost_t> qm(0, 0);
+		qm.reset(ys->size(), xs->size());
+
+		for(size_t yi = 0; yi < ys->size(); ++yi)
 		{
-			for(size_t xi = 0; xi < xs.size(); ++xi)
+			for(size_t xi = 0; xi < xs->size(); ++xi)
 			{
-				std::string const& ye = ys[yi];
-				std::string const& xe = xs[xi];
+				prepared_product::token_t const& ye = ys->token(yi);
+				prepared_product::token_t const& xe = xs->token(xi);
+
+				const size_t length = std::max(ye.size, xe.size);
+
+				// Two empty words, from repeated spaces in both names
+				if(length == 0)
+				{
+					sm(yi, xi) = 1;
+					qm(yi, xi) = resolution;
+					continue;
+				}
+
+				size_t distance_yx;
+				if(ye.id == xe.id)
+					distance_yx = 0;
+				else if(pair_floor > 0.0f)
+				{
+					const float max_distance_f = static_cast<float>(length) * (1.0f - pair_floor) + 0.001f;
+					const size_t max_distance = max_distance_f > 0.0f ? static_cast<size_t>(std::ceil(max_distance_f)) : 0;
+
+					distance_yx = levenshtein_bounded(ys->token_data(yi), ye.size, xs->token_data(xi), xe.size, max_distance);
+					if(distance_yx > max_distance)
+					{
+						sm(yi, xi) = 0;
+						qm(yi, xi) = 0;
+						continue;
+					}
+				}
+				else
+					distance_yx = levenshtein(ys->token_data(yi), ye.size, xs->token_data(xi), xe.size);
 
-				size_t distance_yx(levenshtein(ye, xe));
 				assert(distance_yx >= 0 && distance_yx <= std::numeric_limits<sim_t>::max());
 
-				sm(yi, xi) = static_cast<sim_t>(std::max(ye.size(), xe.size()) - distance_yx) / (sim_t)std::max(ye.size(), xe.size());
+				sm(yi, xi) = static_cast<sim_t>(length - distance_yx) / (sim_t)length;
+				qm(yi, xi) = static_cast<cost_t>(std::lround(sm(yi, xi) * resolution));
 			}
 		}
 
-		hungarian_fast<decltype(sm)::similarity> h(sm);
-		auto matching = h.produce();
-
 		float similarity = 0.0f;
-		for(auto matching_e : matching)
-		{
-			size_t yi = matching_e.first;
-			size_t xi = matching_e.second;
-
+		auto add_similarity = [&](size_t yi, size_t xi) {
 			similarity += (float)sm(yi, xi);
-		}
+		};
 
-		float sim_min = std::min(ys.size(), xs.size()); // Due to std::swap ys.size() will always be bigger, Hungarian will thus always yield xs.size() elements
-		float sim_max = std::max(ys.size(), xs.size());
+		// Names rarely have more than a handful of words; solve those entirely on the stack
+		typedef assignment_fixed_workspace<cost_t, 16> small_workspace_t;
+		if(small_workspace_t::fits(ys->size()))
+		{
+			small_workspace_t ws;
+			assignment_solver<cost_t, small_workspace_t>(qm, ws).produce(add_similarity);
+		}
+		else
+		{
+			thread_local assignment_workspace<cost_t> ws;
+			assignment_solver<cost_t>(qm, ws).produce(add_similarity);
+		}
 
 		return 0.9f * similarity / sim_min + 0.1f * similarity / sim_max;
 	}
@@ -105,14 +176,39 @@ private:
 public:
 	similarity() = delete;
 
-	static inline valuation exec(message::product_summary const& x, message::product_summary const& y)
+	/* Compares x and y on name, price and volume.
+	 * When the collapsed valuation can not reach min_collapse, the valuation is merely guaranteed to collapse below it.
+	 * Pass the best collapsed valuation found so far to skip work on candidates that can not beat it.
+	 * The cheap price and volume components are computed first; the name is only compared when it can still make a difference.
+	 */
+	static inline valuation exec(prepared_product const& x, prepared_product const& y, float min_collapse = 0.0f)
 	{
+		const float price = numeric_compare(x.orig_price, y.orig_price);
+		const float volume = (x.volume_measure == y.volume_measure && x.volume == y.volume) ? 1.0f : 0.0f;
+
+		auto const& w(valuation::weights());
+		const float min_textual = (min_collapse - w[1] * price - w[2] * volume) / w[0] - 0.0001f; // Slack for rounding
+
+		// Not even identical names would reach min_collapse
+		if(min_textual > 1.0f)
+			return valuation({
+				0.0f,
+				price,
+				volume
+			});
+
 		return valuation({
-			textual_compare(boost::to_lower_copy(x.name), boost::to_lower_copy(y.name)),
-			numeric_compare(x.orig_price, y.orig_price),
-			(x.volume_measure == y.volume_measure && x.volume == y.volume) ? 1.0f : 0.0f
+			textual_compare(x, y, min_textual),
+			price,
+			volume
 		});
 	}
+
+	static inline valuation exec(message::product_summary const& x, message::product_summary const& y, float min_collapse = 0.0f)
+	{
+		token_pool pool;
+		return exec(prepared_product(x, pool), prepared_product(y, pool), min_collapse);
+	}
 };
 
 }
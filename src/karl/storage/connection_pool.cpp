@@ -0,0 +1,80 @@
+#include <karl/storage/connection_pool.hpp>
+
+#include <stdexcept>
+
+namespace supermarx
+{
+
+connection_pool::handle::handle(connection_pool& _pool, pqxx::connection& _conn)
+	: pool(&_pool)
+	, conn(&_conn)
+{}
+
+connection_pool::handle::handle(handle&& rhs)
+	: pool(rhs.pool)
+	, conn(rhs.conn)
+{
+	rhs.pool = nullptr;
+	rhs.conn = nullptr;
+}
+
+connection_pool::handle::~handle()
+{
+	if(pool != nullptr)
+		pool->checkin(*conn);
+}
+
+pqxx::connection& connection_pool::handle::operator*() const
+{
+	return *conn;
+}
+
+pqxx::connection* connection_pool::handle::operator->() const
+{
+	return conn;
+}
+
+connection_pool::connection_pool(std::string const& connstr, size_t size, setup_t const& setup)
+	: connections()
+	, idle()
+	, m()
+	, cv_idle()
+{
+	if(size == 0)
+		throw std::logic_error("Connection pool must hold at least one connection");
+
+	for(size_t i = 0; i < size; ++i)
+	{
+		connections.emplace_back(new pqxx::connection(connstr));
+		setup(*connections.back());
+		idle.emplace_back(connections.back().get());
+	}
+}
+
+size_t connection_pool::size() const
+{
+	return connections.size();
+}
+
+connection_pool::handle connection_pool::checkout()
+{
+	std::unique_lock<std::mutex> lock(m);
+	cv_idle.wait(lock, [&]() { return !idle.empty(); });
+
+	pqxx::connection* conn = idle.back();
+	idle.pop_back();
+
+	return handle(*this, *conn);
+}
+
+void connection_pool::checkin(pqxx::connection& conn)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		idle.emplace_back(&conn);
+	}
+
+	cv_idle.notify_one();
+}
+
+}
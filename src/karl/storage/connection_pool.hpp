@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include <pqxx/pqxx>
+
+namespace supermarx
+{
+
+/* Fixed set of database connections, shared by threads that each check out a connection for the duration of their work.
+ * A checkout blocks while every connection is in use. Connections are opened up front, and set up with the given function.
+ */
+class connection_pool
+{
+public:
+	typedef std::function<void(pqxx::connection&)> setup_t;
+
+	/* Checked out connection, which is returned to the pool when the handle goes out of scope */
+	class handle
+	{
+	private:
+		connection_pool* pool;
+		pqxx::connection* conn;
+
+	public:
+		handle(handle&) = delete;
+		void operator=(handle&) = delete;
+
+		handle(connection_pool& pool, pqxx::connection& conn);
+		handle(handle&& rhs);
+		~handle();
+
+		pqxx::connection& operator*() const;
+		pqxx::connection* operator->() const;
+	};
+
+private:
+	std::vector<std::unique_ptr<pqxx::connection>> connections;
+	std::vector<pqxx::connection*> idle;
+
+	std::mutex m;
+	std::condition_variable cv_idle;
+
+	void checkin(pqxx::connection& conn);
+
+public:
+	connection_pool(connection_pool&) = delete;
+	void operator=(connection_pool&) = delete;
+
+	connection_pool(std::string const& connstr, size_t size, setup_t const& setup);
+
+	size_t size() const;
+
+	handle checkout();
+};
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+#include <supermarx/id_t.hpp>
+#include <supermarx/datetime.hpp>
+#include <supermarx/data/productdetails.hpp>
+
+#include <boost/fusion/include/adapt_struct.hpp>
+
+namespace supermarx
+{
+namespace data
+{
+
+/* The columns of product_current read back for a catalog; the row of a product holding its current price.
+ * Only written by the statements in sql/, in the same transaction as the productdetails it mirrors.
+ */
+struct product_current
+{
+	reference<productdetails> productdetails_id;
+	uint64_t orig_price;
+	uint64_t price;
+	uint64_t discount_amount;
+	datetime valid_on;
+	uint64_t orig_price_normalized;
+	uint64_t price_normalized;
+};
+
+}
+}
+
+BOOST_FUSION_ADAPT_STRUCT(
+		supermarx::data::product_current,
+		(supermarx::reference<supermarx::data::productdetails>, productdetails_id)
+		(uint64_t, orig_price)
+		(uint64_t, price)
+		(uint64_t, discount_amount)
+		(supermarx::datetime, valid_on)
+		(uint64_t, orig_price_normalized)
+		(uint64_t, price_normalized)
+)
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <pqxx/pqxx>
+
+namespace supermarx
+{
+
+/* Process-wide registry of the queries generated by query_gen and query_builder.
+ * Every query is executed as a server-side prepared statement, named after a hash of its text.
+ * Names are thus stable between runs, and the same query text always shares one statement and one call count.
+ */
+class statement_registry
+{
+public:
+	struct entry_t
+	{
+		std::string name;
+		std::string query;
+		std::atomic<uint64_t> calls;
+
+		entry_t(std::string const& _name, std::string const& _query)
+			: name(_name)
+			, query(_query)
+			, calls(0)
+		{}
+	};
+
+	struct stat_t
+	{
+		std::string name;
+		std::string query;
+		uint64_t calls;
+	};
+
+private:
+	std::mutex m;
+	std::deque<entry_t> entries; // Never moves its elements
+	std::unordered_map<std::string, entry_t*> by_name;
+
+	statement_registry()
+		: m()
+		, entries()
+		, by_name()
+	{}
+
+	static std::string name_of(std::string const& query)
+	{
+		// FNV-1a
+		uint64_t h = 14695981039346656037ull;
+		for(char c : query)
+		{
+			h ^= static_cast<unsigned char>(c);
+			h *= 1099511628211ull;
+		}
+
+		static const char digits[] = "0123456789abcdef";
+
+		std::string name("GEN_STATEMENT_");
+		for(size_t i = 0; i < 16; ++i)
+			name.push_back(digits[(h >> (60 - 4 * i)) & 0xf]);
+
+		return name;
+	}
+
+public:
+	statement_registry(statement_registry&) = delete;
+	void operator=(statement_registry&) = delete;
+
+	static statement_registry& instance()
+	{
+		static statement_registry r;
+		return r;
+	}
+
+	entry_t& add(std::string const& query)
+	{
+		std::string name(name_of(query));
+
+		std::lock_guard<std::mutex> lock(m);
+
+		auto it = by_name.find(name);
+		if(it != by_name.end())
+		{
+			if(it->second->query != query)
+				throw std::logic_error("Statement name " + name + " is shared by two different queries");
+
+			return *it->second;
+		}
+
+		entries.emplace_back(name, query);
+		by_name.emplace(name, &entries.back());
+		return entries.back();
+	}
+
+	/* Statements by descending number of calls */
+	std::vector<stat_t> stats()
+	{
+		std::vector<stat_t> result;
+
+		{
+			std::lock_guard<std::mutex> lock(m);
+			for(entry_t const& e : entries)
+				result.emplace_back(stat_t({e.name, e.query, e.calls.load()}));
+		}
+
+		std::stable_sort(result.begin(), result.end(), [](stat_t const& x, stat_t const& y) {
+			return x.calls > y.calls;
+		});
+
+		return result;
+	}
+};
+
+/* A generated query, to be kept as a static local next to where it is used:
+ *     static generated_statement q(query_gen::simple_select<...>(...));
+ *     q.prepared(txn)(arg).exec();
+ */
+class generated_statement
+{
+private:
+	statement_registry::entry_t& e;
+
+public:
+	generated_statement(std::string const& query)
+		: e(statement_registry::instance().add(query))
+	{}
+
+	std::string const& name() const
+	{
+		return e.name;
+	}
+
+	std::string const& query() const
+	{
+		return e.query;
+	}
+
+	pqxx::prepare::invocation prepared(pqxx::transaction_base& txn) const
+	{
+		// Defining an already defined statement is a no-op; pqxx prepares it on the server upon first use
+		txn.conn().prepare(e.name, e.query);
+		e.calls.fetch_add(1, std::memory_order_relaxed);
+
+		return txn.prepared(e.name);
+	}
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include <karl/storage/storage_common.hpp>
 #include <karl/storage/storage_tags.hpp>
+#include <karl/storage/storage_partitions.hpp>
 #include <karl/storage/storage_products.hpp>
 #include <karl/storage/storage_users.hpp>
 
@@ -19,29 +20,57 @@ static std::string create_connstr(const std::string &host, const std::string &us
 	return sstr.str();
 }
 
-storage::storage(const std::string &host, const std::string &user, const std::string &password, const std::string& db)
-	: conn(create_connstr(host, user, password, db))
+storage::storage(const std::string &host, const std::string &user, const std::string &password, const std::string& db, size_t pool_size)
+	: pool(create_connstr(host, user, password, db), pool_size, prepare_statements)
+	, partitions_m()
+	, partitions_known()
+	, productlog_messages_m()
+	, productlog_messages()
 {
-	update_database_schema();
-	prepare_statements();
+	connection_pool::handle conn(pool.checkout());
+	update_database_schema(*conn);
+
+	// Partitions are otherwise only created upon the first sighting in a month
+	const int month = partition_month(datetime_now());
+	ensure_partitions(*conn, {month, month + 1, month + 2});
 }
 
-storage::~storage() {}
+storage::~storage()
+{
+	log_statement_stats();
+}
+
+void storage::log_statement_stats() const
+{
+	for(statement_registry::stat_t const& s : statement_registry::instance().stats())
+	{
+		if(s.calls == 0)
+			break;
+
+		std::string query(s.query);
+		std::replace(query.begin(), query.end(), '\n', ' ');
+
+		log("storage::log_statement_stats", log::level_e::NOTICE)() << "Called " << s.name << " " << s.calls << " times: " << query;
+	}
+}
 
 void storage::check_integrity()
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 	check_tag_consistency(txn);
 }
 
 reference<data::imagecitation> storage::add_image_citation(data::imagecitation const& ic)
 {
-	return write_simple_with_id(conn, ic);
+	connection_pool::handle conn(pool.checkout());
+	return write_simple_with_id(*conn, ic);
 }
 
 void storage::update_product_image_citation(const std::string &product_identifier, reference<data::supermarket> supermarket_id, reference<data::imagecitation> imagecitation_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	pqxx::result result = txn.prepared(conv(statement::update_product_image_citation))
 			(imagecitation_id.unseal())
@@ -54,7 +83,7 @@ void storage::update_product_image_citation(const std::string &product_identifie
 #define ADD_SCHEMA(ID)\
 	schema_queries.emplace(std::make_pair(ID, std::string(reinterpret_cast<char*>(sql_schema_ ## ID), sql_schema_ ## ID ## _len)));
 
-void storage::update_database_schema()
+void storage::update_database_schema(pqxx::connection& conn)
 {
 	std::map<unsigned int, std::string> schema_queries;
 	ADD_SCHEMA(1);
@@ -69,8 +98,14 @@ void storage::update_database_schema()
 	ADD_SCHEMA(10);
 	ADD_SCHEMA(11);
 	ADD_SCHEMA(13);
+	ADD_SCHEMA(14);
+	ADD_SCHEMA(15);
+	ADD_SCHEMA(16);
+	ADD_SCHEMA(17);
+	ADD_SCHEMA(18);
+	ADD_SCHEMA(19);
 
-	const size_t target_schema_version = 13;
+	const size_t target_schema_version = 19;
 
 	unsigned int schema_version = 0;
 	try
@@ -134,7 +169,7 @@ void storage::update_database_schema()
 #define PREPARE_STATEMENT(NAME)\
 	conn.prepare(conv(statement::NAME), std::string(reinterpret_cast<char*>(sql_ ## NAME), sql_ ## NAME ## _len));
 
-void storage::prepare_statements()
+void storage::prepare_statements(pqxx::connection& conn)
 {
 	PREPARE_STATEMENT(absorb_productclass_product)
 	PREPARE_STATEMENT(absorb_productclass_delete_tag_productclass)
@@ -151,6 +186,29 @@ void storage::prepare_statements()
 	PREPARE_STATEMENT(update_product_image_citation);
 
 	PREPARE_STATEMENT(invalidate_productdetails)
+
+	PREPARE_STATEMENT(find_add_product)
+
+	PREPARE_STATEMENT(add_products_find_products)
+	PREPARE_STATEMENT(add_products_insert_products)
+
+	PREPARE_STATEMENT(upsert_product_current)
+	PREPARE_STATEMENT(update_productdetails_last_record)
+
+	PREPARE_STATEMENT(insert_productdetailsrecord)
+	PREPARE_STATEMENT(fold_productdetailsrecord)
+	PREPARE_STATEMENT(compact_productdetailsrecord)
+
+	PREPARE_STATEMENT(insert_productlog)
+	PREPARE_STATEMENT(ensure_partitions)
+	PREPARE_STATEMENT(expire_productlog)
+
+	PREPARE_STATEMENT(find_add_productlog_message)
+
+	PREPARE_STATEMENT(check_tag_cycle)
+
+	PREPARE_STATEMENT(lock_productdetails_range)
+	PREPARE_STATEMENT(get_product_history)
 }
 
 #undef PREPARE_STATEMENT
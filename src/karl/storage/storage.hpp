@@ -1,9 +1,14 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <mutex>
+#include <unordered_map>
 #include <pqxx/pqxx>
 #include <boost/optional.hpp>
 
+#include <karl/storage/connection_pool.hpp>
+
 #include <supermarx/id_t.hpp>
 #include <supermarx/token.hpp>
 #include <supermarx/qualified.hpp>
@@ -42,15 +47,47 @@ public:
 		not_found_error();
 	};
 
+	enum class add_product_result
+	{
+		added, // New product
+		changed, // Known product with new price details
+		unchanged, // Known product with the same price details as last seen; only the sighting is recorded
+		duplicate // Identifier already occurred earlier in the batch; ignored
+	};
+
+	struct compact_result
+	{
+		uint64_t runs; // Records that absorbed the sightings of others
+		uint64_t deleted; // Records absorbed and removed
+	};
+
 private:
-	pqxx::connection conn;
+	connection_pool pool;
+
+	std::mutex partitions_m;
+	std::set<int> partitions_known; // Months for which the partitions of productdetailsrecord and productlog exist
+
+	/* Creates the partitions for the given months (see partition_month) if they do not exist yet */
+	void ensure_partitions(pqxx::connection& conn, std::set<int> months);
+
+	std::mutex productlog_messages_m;
+	std::unordered_map<std::string, id_t> productlog_messages; // Cache of productlog_message, by description
+
+	/* Ids of the given productlog messages, adding those that are new */
+	std::map<std::string, id_t> find_add_productlog_messages(pqxx::connection& conn, std::set<std::string> const& descriptions);
 
 public:
-	storage(std::string const& host, std::string const& user, std::string const& password, const std::string& db);
+	/* Every call checks out its own connection from a pool of pool_size, so calls may be made from several threads at once.
+	 * A call blocks while all connections are in use.
+	 */
+	storage(std::string const& host, std::string const& user, std::string const& password, const std::string& db, size_t pool_size);
 	~storage();
 
 	void check_integrity();
 
+	/* Logs how often every generated statement has been called since startup, most called first */
+	void log_statement_stats() const;
+
 	reference<data::karluser> add_karluser(data::karluser const& user);
 	qualified<data::karluser> get_karluser(reference<data::karluser> karluser_id);
 	qualified<data::karluser> get_karluser_by_name(std::string const& name);
@@ -62,12 +99,23 @@ public:
 	qualified<data::session> get_session_by_token(message::sessiontoken const& token);
 
 	void add_product(reference<data::supermarket> supermarket_id, message::add_product const& ap);
+	std::vector<add_product_result> add_products(reference<data::supermarket> supermarket_id, std::vector<message::add_product> const& aps);
 	message::product_summary get_product(std::string const& identifier, reference<data::supermarket> supermarket_id);
 	std::vector<message::product_summary> get_products(reference<data::supermarket> supermarket_id);
 	std::vector<message::product_summary> get_products_by_name(std::string const& name, reference<data::supermarket> supermarket_id);
 	std::vector<message::product_log> get_recent_productlog(reference<data::supermarket> supermarket_id);
 	message::product_history get_product_history(std::string const& identifier, reference<data::supermarket> supermarket_id);
 
+	/* Folds consecutive records of the same productdetails into a single record per run, keeping those referenced by the productlog.
+	 * Only needed for records written before sightings were folded on ingest.
+	 */
+	compact_result compact_productdetailsrecords();
+
+	/* Drops the partitions of productlog that only hold records from before the given moment, or moves them into archive_schema.
+	 * Returns the number of partitions removed.
+	 */
+	size_t expire_productlog(datetime const& before, boost::optional<std::string> const& archive_schema);
+
 	message::productclass_summary get_productclass(reference<data::productclass> productclass_id);
 	void absorb_productclass(reference<data::productclass> src_productclass_id, reference<data::productclass> dest_productclass_id);
 
@@ -85,7 +133,20 @@ public:
 	void update_product_image_citation(std::string const& product_identifier, reference<data::supermarket> supermarket_id, reference<data::imagecitation> imagecitation_id);
 
 private:
-	void update_database_schema();
-	void prepare_statements();
+	static void update_database_schema(pqxx::connection& conn);
+	static void prepare_statements(pqxx::connection& conn);
 };
+
+inline std::string to_string(storage::add_product_result r)
+{
+	switch(r)
+	{
+	case storage::add_product_result::added: return "added";
+	case storage::add_product_result::changed: return "changed";
+	case storage::add_product_result::unchanged: return "unchanged";
+	case storage::add_product_result::duplicate: return "duplicate";
+	}
+
+	throw std::logic_error("Unknown add_product_result");
+}
 }
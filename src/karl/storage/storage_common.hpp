@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stack>
+#include <algorithm>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -17,9 +18,12 @@
 #include <supermarx/data/tagalias.hpp>
 #include <supermarx/data/tagcategoryalias.hpp>
 
+#include <karl/storage/product_current.hpp>
+
 #include "sql.cc"
 
 #include <karl/storage/query_gen.hpp>
+#include <karl/storage/statement_registry.hpp>
 #include <karl/storage/table_repository.hpp>
 
 namespace supermarx
@@ -41,6 +45,29 @@ enum class statement : uint8_t
 	update_product_image_citation,
 
 	invalidate_productdetails,
+
+	find_add_product,
+
+	add_products_find_products,
+	add_products_insert_products,
+
+	upsert_product_current,
+	update_productdetails_last_record,
+
+	insert_productdetailsrecord,
+	fold_productdetailsrecord,
+	compact_productdetailsrecord,
+
+	insert_productlog,
+	ensure_partitions,
+	expire_productlog,
+
+	find_add_productlog_message,
+
+	check_tag_cycle,
+
+	lock_productdetails_range,
+	get_product_history,
 };
 
 inline std::string conv(statement rhs)
@@ -74,10 +101,10 @@ static inline T fetch_simple_first(pqxx::connection& conn, statement stmt, ARG c
 }
 
 template<typename T, typename ARG>
-static inline T fetch_simple_first(pqxx::connection& conn, std::string const& q, ARG const& arg)
+static inline T fetch_simple_first(pqxx::connection& conn, generated_statement const& q, ARG const& arg)
 {
 	pqxx::work txn(conn);
-	pqxx::result result(txn.parameterized(q)(arg).exec());
+	pqxx::result result(q.prepared(txn)(arg).exec());
 	return read_first_result<T>(result);
 }
 
@@ -109,8 +136,8 @@ static inline reference<T> write_with_id(pqxx::transaction_base& txn, statement
 template<typename T>
 static inline reference<T> write_with_id(pqxx::transaction_base& txn, T const& x)
 {
-	static std::string q = query_gen::simple_insert_with_id<T>(table_repository::lookup<T>());
-	auto invo(txn.parameterized(q));
+	static generated_statement q = query_gen::simple_insert_with_id<T>(table_repository::lookup<T>());
+	auto invo(q.prepared(txn));
 	write_invo<T>(invo, x);
 	pqxx::result result(invo.exec());
 	return reference<T>(read_id(result));
@@ -119,12 +146,92 @@ static inline reference<T> write_with_id(pqxx::transaction_base& txn, T const& x
 template<typename T>
 static inline pqxx::result write(pqxx::transaction_base& txn, T const& x)
 {
-	static std::string q = query_gen::simple_insert<T>(table_repository::lookup<T>());
-	auto invo(txn.parameterized(q));
+	static generated_statement q = query_gen::simple_insert<T>(table_repository::lookup<T>());
+	auto invo(q.prepared(txn));
 	write_invo<T>(invo, x);
 	return invo.exec();
 }
 
+namespace detail
+{
+
+/* Copies the objects in [begin, end) into table, which has at least the columns of T */
+template<typename T, typename IT>
+static inline void copy_batch(pqxx::transaction_base& txn, std::string const& table, IT begin, IT end)
+{
+	static const std::vector<std::string> columns(([]() {
+		std::vector<std::string> columns;
+		supermarx::name_itr<T>([&](std::string const& name) { columns.emplace_back(name); });
+		return columns;
+	})());
+
+	pqxx::tablewriter w(txn, table, columns.begin(), columns.end(), copy_row::null_str());
+
+	std::vector<std::string> fields;
+	fields.reserve(columns.size());
+
+	for(; begin != end; ++begin)
+	{
+		fields.clear();
+		copy_row invo(fields);
+		write_invo<T>(invo, *begin);
+		w << fields;
+	}
+
+	w.complete();
+}
+
+}
+
+/* Writes all objects in [begin, end) with a single COPY instead of an insert per object */
+template<typename T, typename IT>
+static inline void write_batch(pqxx::transaction_base& txn, IT begin, IT end)
+{
+	detail::copy_batch<T>(txn, table_repository::lookup<T>(), begin, end);
+}
+
+template<typename T>
+static inline void write_batch(pqxx::transaction_base& txn, std::vector<T> const& xs)
+{
+	write_batch<T>(txn, xs.begin(), xs.end());
+}
+
+/* As write_batch, returning the ids of the written objects in the same order.
+ * The objects are copied into a temporary staging table with the columns and defaults of the table first,
+ * such that every row draws its id from the sequence of the table, in the order they were copied.
+ * They are then moved into the table in a single insert.
+ */
+template<typename T>
+static inline std::vector<reference<T>> write_batch_with_id(pqxx::transaction_base& txn, std::vector<T> const& xs)
+{
+	static const std::string table(table_repository::lookup<T>());
+	static const std::string staging("write_batch_" + table);
+	static generated_statement q_move("insert into " + table + " select * from " + staging + " returning id");
+
+	std::vector<reference<T>> ids;
+	ids.reserve(xs.size());
+
+	if(xs.empty())
+		return ids;
+
+	txn.exec("create temporary table if not exists " + staging + " (like " + table + " including defaults) on commit drop");
+	txn.exec("truncate " + staging);
+
+	detail::copy_batch<T>(txn, staging, xs.begin(), xs.end());
+
+	std::vector<id_t> raw_ids;
+	raw_ids.reserve(xs.size());
+	for(auto row : q_move.prepared(txn).exec())
+		raw_ids.emplace_back(row[0].as<id_t>());
+
+	// A sequence only ever counts up within a session, thus ascending ids are in the order of xs
+	std::sort(raw_ids.begin(), raw_ids.end());
+	for(id_t id : raw_ids)
+		ids.emplace_back(id);
+
+	return ids;
+}
+
 template<typename T>
 static inline pqxx::result write_simple(pqxx::connection& conn, T const& x)
 {
@@ -146,22 +253,12 @@ static inline reference<T> write_simple_with_id(pqxx::connection& conn, T const&
 template<typename T>
 static inline bool update_simple(pqxx::transaction_base& txn, reference<T> const& id, T const& x)
 {
-	static std::string q = query_gen::simple_update<T>(table_repository::lookup<T>());
-	auto invo(txn.parameterized(q));
+	static generated_statement q = query_gen::simple_update<T>(table_repository::lookup<T>());
+	auto invo(q.prepared(txn));
 	write_invo<T>(invo, x);
 	invo(id.unseal()); // Write id condition
 	pqxx::result result(invo.exec());
 	return (result.affected_rows() > 0);
 }
 
-void lock_products_read(pqxx::transaction_base& txn)
-{
-	txn.exec("lock table product in access share mode");
-}
-
-void lock_products_write(pqxx::transaction_base& txn)
-{
-	txn.exec("lock table product in access exclusive mode");
-}
-
 }
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <karl/storage/storage_common.hpp>
+
+namespace supermarx
+{
+
+/* Months are numbered as year * 12 + month - 1 */
+inline static int partition_month(datetime const& x)
+{
+	const date d(x.date());
+	return d.year() * 12 + d.month() - 1;
+}
+
+inline static datetime partition_month_start(int month)
+{
+	return datetime(date(month / 12, month % 12 + 1, 1));
+}
+
+void storage::ensure_partitions(pqxx::connection& conn, std::set<int> months)
+{
+	{
+		std::lock_guard<std::mutex> lock(partitions_m);
+		for(auto it = months.begin(); it != months.end();)
+			if(partitions_known.find(*it) != partitions_known.end())
+				it = months.erase(it);
+			else
+				++it;
+	}
+
+	if(months.empty())
+		return;
+
+	// In a transaction of its own, as creating a partition locks the entire table until commit
+	pqxx::work txn(conn);
+
+	size_t created = 0;
+	for(int month : months)
+		created += txn.prepared(conv(statement::ensure_partitions))
+				(to_pg_string(partition_month_start(month))).exec()[0][0].as<size_t>();
+
+	txn.commit();
+
+	if(created > 0)
+		log("storage::ensure_partitions", log::level_e::NOTICE)() << "Created " << created << " partitions";
+
+	std::lock_guard<std::mutex> lock(partitions_m);
+	partitions_known.insert(months.begin(), months.end());
+}
+
+size_t storage::expire_productlog(datetime const& before, boost::optional<std::string> const& archive_schema)
+{
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+
+	const size_t expired = txn.prepared(conv(statement::expire_productlog))
+			(to_pg_string(before))
+			(archive_schema ? *archive_schema : std::string(), static_cast<bool>(archive_schema)).exec()[0][0].as<size_t>();
+
+	txn.commit();
+
+	// Months before the cutoff might have lost their partitions; those of productdetailsrecord are never expired however
+	std::lock_guard<std::mutex> lock(partitions_m);
+	partitions_known.erase(partitions_known.begin(), partitions_known.lower_bound(partition_month(before)));
+
+	return expired;
+}
+
+}
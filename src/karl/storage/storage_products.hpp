@@ -1,5 +1,7 @@
 #pragma once
 
+#include <set>
+
 #include <karl/storage/storage_common.hpp>
 
 namespace supermarx
@@ -24,6 +26,37 @@ inline static message::product_summary merge(data::product const& p, data::produ
 	});
 }
 
+inline static message::product_summary merge(data::product const& p, data::product_current const& pc)
+{
+	return message::product_summary({
+		p.identifier,
+		p.supermarket_id,
+		p.name,
+		p.productclass_id,
+		p.volume,
+		p.volume_measure,
+		pc.orig_price,
+		pc.price,
+		pc.discount_amount,
+		price_normalization::exec_normalized(pc.orig_price_normalized, p.volume, p.volume_measure),
+		price_normalization::exec_normalized(pc.price_normalized, p.volume, p.volume_measure),
+		pc.valid_on,
+		p.imagecitation_id
+	});
+}
+
+/* Products joined with their current price; one row per product */
+inline static query_builder current_products()
+{
+	query_builder qb("product");
+	qb.add_join("product_current", { query_builder::condition_t("product.id", "product_current.product_id") });
+
+	qb.add_fields<data::product>("product");
+	qb.add_fields<data::product_current>("product_current");
+
+	return qb;
+}
+
 inline static query_builder last_productdetails()
 {
 	query_builder qb("product");
@@ -38,9 +71,9 @@ inline static query_builder last_productdetails()
 
 qualified<data::product> find_product_unsafe(pqxx::transaction_base& txn, reference<data::supermarket> supermarket_id, std::string const& identifier)
 {
-	static std::string q = query_gen::simple_select<qualified<data::product>>("product", {{"product.identifier"}, {"product.supermarket_id"}});
+	static generated_statement q = query_gen::simple_select<qualified<data::product>>("product", {{"product.identifier"}, {"product.supermarket_id"}});
 
-	pqxx::result result = txn.parameterized(q)
+	pqxx::result result = q.prepared(txn)
 			(identifier)
 			(supermarket_id.unseal()).exec();
 
@@ -49,79 +82,132 @@ qualified<data::product> find_product_unsafe(pqxx::transaction_base& txn, refere
 
 qualified<data::productdetails> fetch_last_productdetails_unsafe(pqxx::transaction_base& txn, reference<data::product> product_id)
 {
-	static std::string q = ([]() {
+	static generated_statement q = ([]() {
 		query_builder qb(last_productdetails());
 		qb.add_cond("productdetails.product_id");
 		return qb.select_str();
 	})();
 
-	pqxx::result result = txn.parameterized(q)
+	pqxx::result result = q.prepared(txn)
 			(product_id.unseal()).exec();
 	return read_first_result<qualified<data::productdetails>>(result);
 }
 
+data::product_current fetch_product_current_unsafe(pqxx::transaction_base& txn, reference<data::product> product_id)
+{
+	static generated_statement q = query_gen::simple_select<data::product_current>("product_current", {{"product_current.product_id"}});
+
+	pqxx::result result = q.prepared(txn)
+			(product_id.unseal()).exec();
+	return read_first_result<data::product_current>(result);
+}
+
 qualified<data::product> find_add_product(pqxx::connection& conn, reference<data::supermarket> supermarket_id, message::product_base const& pb)
 {
+	// Adding is a single upsert, relying on the unique index on (identifier, supermarket_id) instead of table locks.
+	// When a concurrent transaction adds the same product first, the upsert yields no row; rolling back
+	// also drops the productclass made for it, after which the product of the other transaction is found.
+	static const size_t max_attempts = 8;
+
+	for(size_t attempt = 0; attempt < max_attempts; ++attempt)
 	{
 		pqxx::work txn(conn);
-		lock_products_read(txn);
+		pqxx::result result = txn.prepared(conv(statement::find_add_product))
+				(pb.identifier)
+				(supermarket_id.unseal())
+				(pb.name)
+				(pb.volume)
+				(to_string(pb.volume_measure)).exec();
 
-		try
-		{
-			return find_product_unsafe(txn, supermarket_id, pb.identifier);
-		} catch(storage::not_found_error)
-		{}
+		if(result.size() == 0)
+			continue;
+
+		txn.commit();
+		return read_first_result<qualified<data::product>>(result);
 	}
 
-	{
-		pqxx::work txn(conn);
-		lock_products_write(txn);
+	throw std::runtime_error("Could not find or add product " + pb.identifier + " due to concurrent modifications");
+}
 
-		try
-		{
-			return find_product_unsafe(txn, supermarket_id, pb.identifier);
-		} catch(storage::not_found_error)
-		{}
+std::map<std::string, id_t> storage::find_add_productlog_messages(pqxx::connection& conn, std::set<std::string> const& descriptions)
+{
+	std::map<std::string, id_t> result;
+	std::vector<std::string> missing;
 
-		reference<data::productclass> productclass_id(write_with_id(txn, data::productclass({pb.name})));
+	{
+		std::lock_guard<std::mutex> lock(productlog_messages_m);
+		for(std::string const& description : descriptions)
+		{
+			auto it = productlog_messages.find(description);
+			if(it == productlog_messages.end())
+				missing.emplace_back(description);
+			else
+				result.emplace(description, it->second);
+		}
+	}
 
-		data::product p({
-			pb.identifier,
-			supermarket_id,
-			boost::none,
-			productclass_id,
-			pb.name,
-			pb.volume,
-			pb.volume_measure
-		});
+	if(missing.empty())
+		return result;
 
-		reference<data::product> product_id(write_with_id(txn, p));
-		txn.commit();
+	// In a transaction of its own, such that the cache never holds the id of a message that was rolled back
+	pqxx::work txn(conn);
 
-		return qualified<data::product>(product_id, p);
+	for(std::string const& description : missing)
+	{
+		pqxx::result r(txn.prepared(conv(statement::find_add_productlog_message))(description).exec());
+		result.emplace(description, read_id(r));
 	}
+
+	txn.commit();
+
+	std::lock_guard<std::mutex> lock(productlog_messages_m);
+	for(std::string const& description : missing)
+		productlog_messages.emplace(description, result[description]);
+
+	return result;
 }
 
-void register_productdetailsrecord(pqxx::transaction_base& txn, data::productdetailsrecord const& pdr, std::vector<std::string> const& problems)
+void register_productdetailsrecord(pqxx::transaction_base& txn, data::productdetailsrecord const& pdr, std::vector<id_t> const& message_ids)
 {
-	reference<data::productdetailsrecord> pdn_id(write_with_id(txn, pdr));
-
-	for(std::string const& p_str : problems)
-		write(txn, data::productlog({pdn_id, p_str}));
+	reference<data::productdetailsrecord> pdn_id(write_with_id(txn, statement::insert_productdetailsrecord, pdr));
+
+	txn.prepared(conv(statement::update_productdetails_last_record))
+			(pdn_id.unseal())
+			(to_pg_string(pdr.retrieved_on))
+			(pdr.productdetails_id.unseal()).exec();
+
+	// data::productlog lacks the retrieved_on of its record, by which productlog is partitioned
+	for(id_t message_id : message_ids)
+		txn.prepared(conv(statement::insert_productlog))
+				(pdn_id.unseal())
+				(to_pg_string(pdr.retrieved_on))
+				(message_id).exec();
 }
 
 void storage::add_product(reference<data::supermarket> supermarket_id, message::add_product const& ap_new)
 {
 	message::product_base const& p_new = ap_new.p;
 
-	qualified<data::product> p_canonical(find_add_product(conn, supermarket_id, ap_new.p));
+	connection_pool::handle conn(pool.checkout());
+	ensure_partitions(*conn, {partition_month(ap_new.retrieved_on)});
 
-	pqxx::work txn(conn);
-	if(
+	std::vector<id_t> message_ids;
+	{
+		std::map<std::string, id_t> messages(find_add_productlog_messages(*conn, {ap_new.problems.begin(), ap_new.problems.end()}));
+		for(std::string const& p_str : ap_new.problems)
+			message_ids.emplace_back(messages[p_str]);
+	}
+
+	qualified<data::product> p_canonical(find_add_product(*conn, supermarket_id, ap_new.p));
+
+	pqxx::work txn(*conn);
+	const bool product_changed = (
 		p_canonical.data.name != p_new.name ||
 		p_canonical.data.volume != p_new.volume ||
 		p_canonical.data.volume_measure != p_new.volume_measure
-	)
+	);
+
+	if(product_changed)
 	{
 		p_canonical = read_first_result<qualified<data::product>>(
 			txn.prepared(conv(statement::update_product))
@@ -147,13 +233,27 @@ void storage::add_product(reference<data::supermarket> supermarket_id, message::
 
 		if(similar)
 		{
-			data::productdetailsrecord pdr({
-				pd_old.id,
-				ap_new.retrieved_on,
-				ap_new.c
-			});
+			// A sighting without problems extends the run of the last record, unless that one has problems of its own
+			bool folded = ap_new.problems.empty() && txn.prepared(conv(statement::fold_productdetailsrecord))
+					(pd_old.id.unseal())
+					(to_pg_string(ap_new.retrieved_on))
+					(to_string(ap_new.c)).exec().affected_rows() > 0;
+
+			if(!folded)
+			{
+				data::productdetailsrecord pdr({
+					pd_old.id,
+					ap_new.retrieved_on,
+					ap_new.c
+				});
+
+				register_productdetailsrecord(txn, pdr, message_ids);
+			}
+
+			// The same productdetails are still current; only a new volume changes the normalized prices
+			if(product_changed)
+				txn.prepared(conv(statement::upsert_product_current))(p_canonical.id.unseal()).exec();
 
-			register_productdetailsrecord(txn, pdr, ap_new.problems);
 			txn.commit();
 			return;
 		}
@@ -187,42 +287,182 @@ void storage::add_product(reference<data::supermarket> supermarket_id, message::
 		ap_new.c
 	});
 
-	register_productdetailsrecord(txn, pdr, ap_new.problems);
+	register_productdetailsrecord(txn, pdr, message_ids);
+	txn.prepared(conv(statement::upsert_product_current))(p_canonical.id.unseal()).exec();
 	txn.commit();
 }
 
-message::product_summary storage::get_product(const std::string &identifier, reference<data::supermarket> supermarket_id)
+#define SQL_TEXT(NAME)\
+	std::string(reinterpret_cast<char*>(sql_ ## NAME), sql_ ## NAME ## _len)
+
+typedef std::vector<std::string> staging_row_t;
+
+template<typename F>
+void copy_staging(pqxx::transaction_base& txn, std::string const& table, staging_row_t const& columns, F f)
 {
-	pqxx::work txn(conn);
+	// Never equal to a value, as text can not contain NUL; no staged input is null
+	const std::string null_str(1, '\0');
+
+	pqxx::tablewriter w(txn, table, columns.begin(), columns.end(), null_str);
+	f(w);
+	w.complete();
+}
+
+std::vector<storage::add_product_result> storage::add_products(reference<data::supermarket> supermarket_id, std::vector<message::add_product> const& aps)
+{
+	std::vector<add_product_result> results(aps.size(), add_product_result::duplicate);
+
+	std::vector<bool> staged(aps.size(), false);
+	{
+		std::set<std::string> identifiers;
+		for(size_t i = 0; i < aps.size(); ++i)
+			staged[i] = identifiers.emplace(aps[i].p.identifier).second;
+	}
+
+	connection_pool::handle conn(pool.checkout());
 
-	lock_products_read(txn);
+	std::map<std::string, id_t> messages;
+	{
+		std::set<int> months;
+		std::set<std::string> descriptions;
+		for(size_t i = 0; i < aps.size(); ++i)
+			if(staged[i])
+			{
+				months.emplace(partition_month(aps[i].retrieved_on));
+				descriptions.insert(aps[i].problems.begin(), aps[i].problems.end());
+			}
+
+		ensure_partitions(*conn, months);
+		messages = find_add_productlog_messages(*conn, descriptions);
+	}
+
+	// As in find_add_product, a concurrent transaction may add some of the new products first; the batch is then retried
+	static const size_t max_attempts = 8;
+
+	for(size_t attempt = 0; attempt < max_attempts; ++attempt)
+	{
+		pqxx::work txn(*conn);
+
+		// Tags are few and mostly shared between products; the distinct ones are looked up one by one, and the new ones added at once
+		std::map<tag_key_t, reference<data::tag>> tag_ids;
+		{
+			std::set<tag_key_t> tag_keys;
+			for(size_t i = 0; i < aps.size(); ++i)
+				if(staged[i])
+					for(message::tag const& t : aps[i].p.tags)
+						tag_keys.emplace(t.category, t.name);
+
+			tag_ids = find_add_tags(txn, tag_keys);
+		}
+
+		txn.exec(SQL_TEXT(add_products_stage));
+
+		copy_staging(txn, "add_products_staging", {"ord", "identifier", "name", "volume", "volume_measure", "orig_price", "price", "discount_amount", "valid_on", "retrieved_on", "confidence"}, [&](pqxx::tablewriter& w)
+		{
+			for(size_t i = 0; i < aps.size(); ++i)
+				if(staged[i])
+					w << staging_row_t({
+						boost::lexical_cast<std::string>(i),
+						aps[i].p.identifier,
+						aps[i].p.name,
+						boost::lexical_cast<std::string>(aps[i].p.volume),
+						to_string(aps[i].p.volume_measure),
+						boost::lexical_cast<std::string>(aps[i].p.orig_price),
+						boost::lexical_cast<std::string>(aps[i].p.price),
+						boost::lexical_cast<std::string>(aps[i].p.discount_amount),
+						to_pg_string(aps[i].p.valid_on),
+						to_pg_string(aps[i].retrieved_on),
+						to_string(aps[i].c)
+					});
+		});
+
+		copy_staging(txn, "add_products_staging_problem", {"ord", "productlog_message_id"}, [&](pqxx::tablewriter& w)
+		{
+			for(size_t i = 0; i < aps.size(); ++i)
+				if(staged[i])
+					for(std::string const& p_str : aps[i].problems)
+						w << staging_row_t({boost::lexical_cast<std::string>(i), boost::lexical_cast<std::string>(messages[p_str])});
+		});
+
+		copy_staging(txn, "add_products_staging_tag", {"ord", "tag_id"}, [&](pqxx::tablewriter& w)
+		{
+			for(size_t i = 0; i < aps.size(); ++i)
+				if(staged[i])
+					for(message::tag const& t : aps[i].p.tags)
+						w << staging_row_t({
+							boost::lexical_cast<std::string>(i),
+							boost::lexical_cast<std::string>(tag_ids.at(std::make_pair(t.category, t.name)).unseal())
+						});
+		});
+
+		txn.prepared(conv(statement::add_products_find_products))
+				(supermarket_id.unseal()).exec();
+
+		pqxx::result result_new(txn.exec(SQL_TEXT(add_products_new_productclasses)));
+		pqxx::result result_inserted(txn.prepared(conv(statement::add_products_insert_products))
+				(supermarket_id.unseal()).exec());
+
+		if(result_inserted.affected_rows() != result_new.affected_rows())
+			continue;
+
+		txn.exec(SQL_TEXT(add_products_apply));
+
+		size_t added = 0, changed = 0, unchanged = 0;
+		for(auto row : txn.exec("select ord, new_product, new_details from add_products_staging"))
+		{
+			add_product_result& r(results.at(row["ord"].as<size_t>()));
+
+			if(row["new_product"].as<bool>())
+			{
+				r = add_product_result::added;
+				++added;
+			}
+			else if(row["new_details"].as<bool>())
+			{
+				r = add_product_result::changed;
+				++changed;
+			}
+			else
+			{
+				r = add_product_result::unchanged;
+				++unchanged;
+			}
+		}
+
+		txn.commit();
+
+		log("storage::add_products", log::level_e::NOTICE)() << "Added batch of " << aps.size() << " products for supermarket " << supermarket_id << ": "
+			<< added << " new, " << changed << " changed, " << unchanged << " unchanged, " << (aps.size() - added - changed - unchanged) << " duplicate";
+
+		return results;
+	}
+
+	throw std::runtime_error("Could not add batch of products due to concurrent modifications");
+}
+
+#undef SQL_TEXT
+
+message::product_summary storage::get_product(const std::string &identifier, reference<data::supermarket> supermarket_id)
+{
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	qualified<data::product> p(find_product_unsafe(txn, supermarket_id, identifier));
 
 	try
 	{
-		qualified<data::productdetails> pd(fetch_last_productdetails_unsafe(txn, p.id));
-		return merge(p.data, pd.data);
+		data::product_current pc(fetch_product_current_unsafe(txn, p.id));
+		return merge(p.data, pc);
 	} catch(storage::not_found_error)
 	{
-		throw std::logic_error(std::string("Inconsistency: found product ") + boost::lexical_cast<std::string>(p.id.unseal()) + " but has no (latest) productdetails entry");
+		throw std::logic_error(std::string("Inconsistency: found product ") + boost::lexical_cast<std::string>(p.id.unseal()) + " but has no product_current entry");
 	}
 }
 
 message::product_history storage::get_product_history(std::string const& identifier, reference<data::supermarket> supermarket_id)
 {
-	static std::string q_get_relevant_productdetails_by_product = ([]() {
-		query_builder qb("productdetails");
-		qb.add_field("productdetails.price");
-		qb.add_field("productdetails.valid_on");
-		qb.add_field("productdetailsrecord.retrieved_on");
-		qb.add_join("productdetailsrecord", {{"productdetails.id", "productdetailsrecord.productdetails_id"}});
-		qb.add_cond("productdetails.product_id");
-		qb.add_order_by({"productdetailsrecord.id", true});
-		return qb.select_str();
-	})();
-
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	qualified<data::product> p(find_product_unsafe(txn, supermarket_id, identifier));
 
@@ -232,16 +472,17 @@ message::product_history storage::get_product_history(std::string const& identif
 		{}
 	});
 
-	pqxx::result result = txn.parameterized(q_get_relevant_productdetails_by_product)
+	// A record covers a run of sightings; every sighting is a row, in the order they came in
+	pqxx::result result = txn.prepared(conv(statement::get_product_history))
 			(p.id.unseal()).exec();
 
 	for(auto row : result)
 	{
-		datetime retrieved_on(detail::rcol<datetime>::exec(row, "retrieved_on"));
+		datetime seen_on(detail::rcol<datetime>::exec(row["seen_on"]));
 
-		datetime valid_on(detail::rcol<datetime>::exec(row, "valid_on"));
-		if(valid_on < retrieved_on)
-			valid_on = retrieved_on;
+		datetime valid_on(detail::rcol<datetime>::exec(row["valid_on"]));
+		if(valid_on < seen_on)
+			valid_on = seen_on;
 
 		history.pricehistory.emplace_back(valid_on, row["price"].as<int>());
 	}
@@ -249,106 +490,148 @@ message::product_history storage::get_product_history(std::string const& identif
 	return history;
 }
 
+storage::compact_result storage::compact_productdetailsrecords()
+{
+	// Small ranges of productdetails, such that every transaction only locks a few of them at a time
+	const id_t step = 10000;
+
+	connection_pool::handle conn(pool.checkout());
+
+	id_t max_id;
+	{
+		pqxx::work txn(*conn);
+		max_id = txn.exec("select coalesce(max(id), 0) from productdetails")[0][0].as<id_t>();
+	}
+
+	compact_result total({0, 0});
+	for(id_t begin = 0; begin <= max_id; begin += step)
+	{
+		pqxx::work txn(*conn);
+
+		// Concurrent folds into the same records wait until the range is compacted; see fold_productdetailsrecord
+		txn.prepared(conv(statement::lock_productdetails_range))
+				(begin)
+				(begin + step).exec();
+
+		pqxx::result result = txn.prepared(conv(statement::compact_productdetailsrecord))
+				(begin)
+				(begin + step).exec();
+		txn.commit();
+
+		total.runs += result[0][0].as<uint64_t>();
+		total.deleted += result[0][1].as<uint64_t>();
+
+		log("storage::compact_productdetailsrecords", log::level_e::NOTICE)() << "Compacted productdetails up to " << std::min(begin + step, max_id + 1) << " of " << (max_id + 1) << ": " << total.runs << " runs, " << total.deleted << " records removed";
+	}
+
+	return total;
+}
+
 std::vector<message::product_summary> storage::get_products(reference<data::supermarket> supermarket_id)
 {
-	static std::string q = ([]() {
-		query_builder qb(last_productdetails());
-		qb.add_cond("product.supermarket_id");
+	static generated_statement q = ([]() {
+		query_builder qb(current_products());
+		qb.add_cond("product_current.supermarket_id");
 		return qb.select_str();
 	})();
 
-	pqxx::work txn(conn);
-	pqxx::result result = txn.parameterized(q)
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+	pqxx::result result = q.prepared(txn)
 			(supermarket_id.unseal()).exec();
 
+	result_reader<data::product> read_p(result);
+	result_reader<data::product_current> read_pc(result);
+
 	std::vector<message::product_summary> products;
-	for(auto row : result)
-	{
-		auto p(read_result<data::product>(row));
-		auto pd(read_result<data::productdetails>(row));
+	products.reserve(result.size());
 
-		products.emplace_back(merge(p, pd));
-	}
+	for(auto row : result)
+		products.emplace_back(merge(read_p(row), read_pc(row)));
 
 	return products;
 }
 
 std::vector<message::product_summary> storage::get_products_by_name(std::string const& name, reference<data::supermarket> supermarket_id)
 {
-	static std::string q = ([]() {
-		query_builder qb(last_productdetails());
+	static generated_statement q = ([]() {
+		query_builder qb(current_products());
 		qb.add_cond("lower(product.name)", query_builder::comp_e::LIKE);
 		qb.add_cond("product.supermarket_id");
 		return qb.select_str();
 	})();
 
-	pqxx::work txn(conn);
-	pqxx::result result = txn.parameterized(q)
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+	pqxx::result result = q.prepared(txn)
 			(std::string("%") + txn.esc(name) + "%")
 			(supermarket_id.unseal()).exec();
 
+	result_reader<data::product> read_p(result);
+	result_reader<data::product_current> read_pc(result);
+
 	std::vector<message::product_summary> products;
-	for(auto row : result)
-	{
-		auto p(read_result<data::product>(row));
-		auto pd(read_result<data::productdetails>(row));
+	products.reserve(result.size());
 
-		products.emplace_back(merge(p, pd));
-	}
+	for(auto row : result)
+		products.emplace_back(merge(read_p(row), read_pc(row)));
 
 	return products;
 }
 
 std::vector<message::product_log> storage::get_recent_productlog(reference<data::supermarket> supermarket_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
-	static std::string q = ([](){
+	static generated_statement q = ([](){
 		query_builder qb("product");
 
-		qb.add_join("productdetails", {{"productdetails.product_id", "product.id"}});
-		qb.add_join("productdetailsrecord", {{"productdetailsrecord.productdetails_id", "productdetails.id"}});
-		qb.add_join("productlog", {{"productlog.productdetailsrecord_id", "productdetailsrecord.id"}});
+		qb.add_join("product_current", {{"product_current.product_id", "product.id"}});
+		qb.add_join("productdetails", {{"productdetails.id", "product_current.productdetails_id"}});
+		// Joining on the partition key as well, such that only the partitions of the month of each record are probed
+		qb.add_join("productdetailsrecord", {{"productdetailsrecord.id", "productdetails.last_record_id"}, {"productdetailsrecord.retrieved_on", "productdetails.last_record_retrieved_on"}});
+		qb.add_join("productlog", {{"productlog.productdetailsrecord_id", "productdetailsrecord.id"}, {"productlog.retrieved_on", "productdetailsrecord.retrieved_on"}});
+		qb.add_join("productlog_message", {{"productlog_message.id", "productlog.productlog_message_id"}});
 
-		qb.add_fields({"product.identifier", "product.name", "productlog.description", "productdetailsrecord.retrieved_on"});
+		// Byte order, as std::string compares
+		qb.add_field("product.identifier collate \"C\"", "identifier");
+		qb.add_fields({"product.name", "productlog_message.description", "productdetailsrecord.retrieved_on"});
 
 		qb.add_cond("product.supermarket_id");
-		qb.add_cond("productdetails.valid_until", "null", query_builder::comp_e::IS);
-		qb.add_cond("productdetailsrecord.id", "(select max(pdr2.id) from productdetailsrecord as pdr2 group by pdr2.productdetails_id)", query_builder::comp_e::IN);
+		qb.add_order_by({"identifier", true});
 
 		return qb.select_str(true);
 	})();
 
-	pqxx::result result = txn.parameterized(q)
+	pqxx::result result = q.prepared(txn)
 			(supermarket_id.unseal()).exec();
 
-	std::map<std::string, message::product_log> log_map;
+	const pqxx::result::tuple::size_type
+		col_identifier = result.column_number("identifier"),
+		col_name = result.column_number("name"),
+		col_description = result.column_number("description"),
+		col_retrieved_on = result.column_number("retrieved_on");
 
+	// The rows of a product are adjacent, thus every product starts a new entry
+	std::vector<message::product_log> log;
 	for(auto row : result)
 	{
-		std::string identifier(row["identifier"].as<std::string>());
-		std::string message(row["description"].as<std::string>());
+		std::string identifier(detail::rcol<std::string>::exec(row[col_identifier]));
+		std::string message(detail::rcol<std::string>::exec(row[col_description]));
 
-		auto it = log_map.find(identifier);
-		if(it == log_map.end())
+		if(log.empty() || log.back().identifier != identifier)
 		{
 			message::product_log pl;
-			pl.identifier = identifier;
-			pl.name = row["name"].as<std::string>();
-			pl.messages.emplace_back(message);
-			pl.retrieved_on = to_datetime(row["retrieved_on"].as<std::string>());
+			pl.identifier = std::move(identifier);
+			pl.name = detail::rcol<std::string>::exec(row[col_name]);
+			pl.retrieved_on = detail::rcol<datetime>::exec(row[col_retrieved_on]);
 
-			log_map.insert(std::make_pair(identifier, pl));
+			log.emplace_back(std::move(pl));
 		}
-		else
-		{
-			it->second.messages.emplace_back(message);
-		}
-	}
 
-	std::vector<message::product_log> log;
-	for(auto& p : log_map)
-		log.emplace_back(p.second);
+		log.back().messages.emplace_back(std::move(message));
+	}
 
 	return log;
 }
@@ -357,13 +640,13 @@ message::productclass_summary storage::get_productclass(reference<data::productc
 {
 	message::productclass_summary result;
 
-	static std::string q_productclass = query_gen::simple_select<data::productclass>("productclass", {{"productclass"}});
-	static std::string q_last_productdetails = ([]() {
-		query_builder qb(last_productdetails());
+	static generated_statement q_productclass = query_gen::simple_select<data::productclass>("productclass", {{"productclass"}});
+	static generated_statement q_current_products = ([]() {
+		query_builder qb(current_products());
 		qb.add_cond("product.productclass_id");
 		return qb.select_str();
 	})();
-	static std::string q_tags = ([]() {
+	static generated_statement q_tags = ([]() {
 		query_builder qb("tag");
 		qb.add_join("tag_productclass", { query_builder::condition_t("tag.id", "tag_productclass.tag_id") });
 		qb.add_fields<data::tag>("tag");
@@ -372,36 +655,37 @@ message::productclass_summary storage::get_productclass(reference<data::productc
 		return qb.select_str();
 	})();
 
-	pqxx::work txn(conn);
-	pqxx::result result_productclass = txn.parameterized(q_productclass)
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+	pqxx::result result_productclass = q_productclass.prepared(txn)
 			(productclass_id.unseal()).exec();
 
 	auto pc(read_first_result<data::productclass>(result_productclass));
 	result.name = pc.name;
 
-	pqxx::result result_last_productdetails = txn.parameterized(q_last_productdetails)
+	pqxx::result result_current_products = q_current_products.prepared(txn)
 			(productclass_id.unseal()).exec();
 
-	for(auto row : result_last_productdetails)
-	{
-		auto p(read_result<data::product>(row));
-		auto pd(read_result<data::productdetails>(row));
+	result_reader<data::product> read_p(result_current_products);
+	result_reader<data::product_current> read_pc(result_current_products);
 
-		result.products.emplace_back(merge(p, pd));
-	}
+	for(auto row : result_current_products)
+		result.products.emplace_back(merge(read_p(row), read_pc(row)));
 
-	pqxx::result result_tags = txn.parameterized(q_tags)
+	pqxx::result result_tags = q_tags.prepared(txn)
 			(productclass_id.unseal()).exec();
 
+	result_reader<qualified<data::tag>> read_tag(result_tags);
 	for(auto row : result_tags)
-		result.tags.emplace_back(read_result<qualified<data::tag>>(row));
+		result.tags.emplace_back(read_tag(row));
 
 	return result;
 }
 
 void storage::absorb_productclass(reference<data::productclass> src_productclass_id, reference<data::productclass> dest_productclass_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	id_t src_productclass_idu(src_productclass_id.unseal());
 	id_t dest_productclass_idu(dest_productclass_id.unseal());
@@ -9,6 +9,9 @@
 #include <boost/fusion/include/for_each.hpp>
 #include <boost/fusion/adapted.hpp>
 
+#include <karl/storage/name_iter.hpp>
+#include <karl/util/iso_datetime.hpp>
+
 namespace supermarx
 {
 
@@ -18,71 +21,90 @@ inline T read_result(pqxx::result::tuple const& row);
 namespace detail
 {
 
+typedef pqxx::result::tuple::size_type column_t;
+
 template<typename T>
 struct rcol
 {
-	static inline T exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline T exec(pqxx::result::field const& f)
+	{
+		return f.as<T>();
+	}
+};
+
+template<>
+struct rcol<std::string>
+{
+	static inline std::string exec(pqxx::result::field const& f)
 	{
-		return row[key].as<T>();
+		return std::string(f.c_str(), f.size());
 	}
 };
 
 template<typename T>
 struct rcol<reference<T>>
 {
-	static inline reference<T> exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline reference<T> exec(pqxx::result::field const& f)
 	{
-		return reference<T>(row[key].as<id_t>());
+		return reference<T>(f.as<id_t>());
 	}
 };
 
 template<typename T>
 struct rcol<boost::optional<T>>
 {
-	static inline boost::optional<T> exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline boost::optional<T> exec(pqxx::result::field const& f)
 	{
-		if(row[key].is_null())
+		if(f.is_null())
 			return boost::none;
 		else
-			return rcol<T>::exec(row, key);
+			return rcol<T>::exec(f);
 	}
 };
 
 template<>
 struct rcol<date>
 {
-	static inline date exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline date exec(pqxx::result::field const& f)
 	{
-		return supermarx::to_date(row[key].as<std::string>());
+		date x;
+		if(parse_iso_date(f.c_str(), f.size(), x))
+			return x;
+
+		return supermarx::to_date(std::string(f.c_str(), f.size()));
 	}
 };
 
 template<>
 struct rcol<datetime>
 {
-	static inline datetime exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline datetime exec(pqxx::result::field const& f)
 	{
-		return supermarx::to_datetime(row[key].as<std::string>());
+		datetime x;
+		if(parse_iso_datetime(f.c_str(), f.size(), x))
+			return x;
+
+		return supermarx::to_datetime(std::string(f.c_str(), f.size()));
 	}
 };
 
 template<>
 struct rcol<measure>
 {
-	static inline measure exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline measure exec(pqxx::result::field const& f)
 	{
-		return to_measure(row[key].as<std::string>());
+		return to_measure(std::string(f.c_str(), f.size()));
 	}
 };
 
 template<>
 struct rcol<token>
 {
-	static inline token exec(pqxx::result::tuple const& row, std::string const& key)
+	static inline token exec(pqxx::result::field const& f)
 	{
 		token rhs;
 
-		pqxx::binarystring bs(row[key]);
+		pqxx::binarystring bs(f);
 		if(rhs.size() != bs.size())
 			throw std::runtime_error("Binarystring does not have correct size to fit into token");
 
@@ -94,9 +116,6 @@ struct rcol<token>
 template<typename T, typename N, typename... XS>
 struct read_itr;
 
-template<typename T, typename N>
-using name_t = boost::fusion::extension::struct_member_name<T, N::value>;
-
 template<typename T, typename N>
 using type_t = typename boost::fusion::result_of::value_at<T, N>::type;
 
@@ -106,21 +125,21 @@ using next_t = typename boost::mpl::next<N>::type;
 template<typename T>
 using size_t = typename boost::fusion::result_of::size<T>::type;
 
-/* Mechanics */
+/* Mechanics; cols holds the index of the column of every member, in the order of name_itr<T> */
 template<typename T, typename N, typename... XS>
 struct read_itr
 {
-	static inline T exec(pqxx::result::tuple const& row, XS&&... xs)
+	static inline T exec(pqxx::result::tuple const& row, column_t const* cols, XS&&... xs)
 	{
 		using current_t = type_t<T, N>;
-		return read_itr<T, next_t<N>, XS..., current_t>::exec(row, std::forward<XS>(xs)..., rcol<current_t>::exec(row, name_t<T, N>::call()));
+		return read_itr<T, next_t<N>, XS..., current_t>::exec(row, cols, std::forward<XS>(xs)..., rcol<current_t>::exec(row[cols[N::value]]));
 	}
 };
 
 template<typename T, typename... XS>
 struct read_itr<T, size_t<T>, XS...>
 {
-	static inline T exec(pqxx::result::tuple const&, XS&&... xs)
+	static inline T exec(pqxx::result::tuple const&, column_t const*, XS&&... xs)
 	{
 		return T({std::move(xs)...});
 	}
@@ -129,28 +148,60 @@ struct read_itr<T, size_t<T>, XS...>
 template<typename T>
 struct read_obj
 {
-	static inline T exec(pqxx::result::tuple const& row)
+	static inline T exec(pqxx::result::tuple const& row, column_t const* cols)
 	{
-		return read_itr<T, boost::mpl::int_<0>>::exec(row);
+		return read_itr<T, boost::mpl::int_<0>>::exec(row, cols);
 	}
 };
 
 template<typename T>
 struct read_obj<qualified<T>>
 {
-	static inline qualified<T> exec(pqxx::result::tuple const& row)
+	static inline qualified<T> exec(pqxx::result::tuple const& row, column_t const* cols)
 	{
-		reference<T> id(rcol<reference<T>>::exec(row, "id"));
-		return qualified<T>(id, read_obj<T>::exec(row));
+		reference<T> id(rcol<reference<T>>::exec(row[cols[0]]));
+		return qualified<T>(id, read_obj<T>::exec(row, cols + 1));
 	}
 };
 
+template<typename T, typename R>
+inline std::vector<column_t> resolve_columns(R const& r)
+{
+	std::vector<column_t> cols;
+	supermarx::name_itr<T>([&](std::string const& name) {
+		cols.emplace_back(r.column_number(name));
+	});
+
+	return cols;
+}
+
 } // End of detail
 
+/* Reads objects from the rows of a single result.
+ * Column names are resolved to indices once, instead of for every member of every row.
+ */
+template<typename T>
+class result_reader
+{
+private:
+	std::vector<detail::column_t> cols;
+
+public:
+	explicit result_reader(pqxx::result const& result)
+		: cols(detail::resolve_columns<T>(result))
+	{}
+
+	T operator()(pqxx::result::tuple const& row) const
+	{
+		return detail::read_obj<T>::exec(row, cols.data());
+	}
+};
+
 template<typename T>
 inline T read_result(pqxx::result::tuple const& row)
 {
-	return detail::read_obj<T>::exec(row);
+	const std::vector<detail::column_t> cols(detail::resolve_columns<T>(row));
+	return detail::read_obj<T>::exec(row, cols.data());
 }
 
 }
@@ -2,18 +2,19 @@
 
 #include <karl/storage/storage_common.hpp>
 
+#include <boost/algorithm/string/case_conv.hpp>
+
 namespace supermarx
 {
 
-reference<data::tagcategory> storage::find_add_tagcategory(std::string const& name)
+reference<data::tagcategory> find_add_tagcategory(pqxx::transaction_base& txn, std::string const& name)
 {
-	static std::string q_tagcategoryalias_get = query_gen::simple_select<qualified<data::tagcategoryalias>>(
+	static generated_statement q_tagcategoryalias_get = query_gen::simple_select<qualified<data::tagcategoryalias>>(
 		"tagcategoryalias",
 		{{"lower(tagcategoryalias.name)", "lower($1)"}}
 	);
 
-	pqxx::work txn(conn);
-	pqxx::result result_tagcategoryalias = txn.parameterized(q_tagcategoryalias_get)(name).exec();
+	pqxx::result result_tagcategoryalias = q_tagcategoryalias_get.prepared(txn)(name).exec();
 
 	if(result_tagcategoryalias.size() > 0)
 		return reference<data::tagcategory>(read_id(result_tagcategoryalias, "tagcategory_id"));
@@ -21,29 +22,111 @@ reference<data::tagcategory> storage::find_add_tagcategory(std::string const& na
 	reference<data::tagcategory> tagcategory_id(write_with_id<data::tagcategory>(txn, {name}));
 	write<data::tagcategoryalias>(txn, {tagcategory_id, name});
 
-	txn.commit();
-
 	return tagcategory_id;
 }
 
-reference<data::tag> storage::find_add_tag(std::string const& name, reference<data::tagcategory> tagcategory_id)
+boost::optional<reference<data::tag>> find_tag(pqxx::transaction_base& txn, std::string const& name, reference<data::tagcategory> tagcategory_id)
 {
-	static std::string q_tagalias_get = query_gen::simple_select<qualified<data::tagalias>>(
+	static generated_statement q_tagalias_get = query_gen::simple_select<qualified<data::tagalias>>(
 		"tagalias",
 		{{"tagalias.tagcategory_id", "$1"}, {"lower(tagalias.name)", "lower($2)"}}
 	);
 
-	pqxx::work txn(conn);
-	pqxx::result result_tagalias = txn.parameterized(q_tagalias_get)
+	pqxx::result result_tagalias = q_tagalias_get.prepared(txn)
 			(tagcategory_id.unseal())
 			(name).exec();
 
 	if(result_tagalias.size() > 0)
 		return reference<data::tag>(read_id(result_tagalias, "tag_id"));
 
+	return boost::none;
+}
+
+reference<data::tag> find_add_tag(pqxx::transaction_base& txn, std::string const& name, reference<data::tagcategory> tagcategory_id)
+{
+	boost::optional<reference<data::tag>> tag_id_found(find_tag(txn, name, tagcategory_id));
+	if(tag_id_found)
+		return *tag_id_found;
+
 	reference<data::tag> tag_id(write_with_id(txn, data::tag({boost::none, tagcategory_id, name})));
 	write(txn, data::tagalias({tag_id, tagcategory_id, name}));
 
+	return tag_id;
+}
+
+typedef std::pair<std::string, std::string> tag_key_t; // Category and name
+
+/* As find_add_tag for many tags at once. The tags that are new are added with one COPY for all tags and one for all aliases.
+ * As with find_add_tag, names within a category that only differ in case are the same tag.
+ */
+std::map<tag_key_t, reference<data::tag>> find_add_tags(pqxx::transaction_base& txn, std::set<tag_key_t> const& keys)
+{
+	std::map<tag_key_t, reference<data::tag>> result;
+
+	std::vector<data::tag> new_tags;
+	std::vector<data::tagalias> new_aliases; // Without tag_id until the tags are written
+	std::map<std::pair<id_t, std::string>, size_t> new_tag_i; // By category and lowercase name
+	std::vector<std::pair<tag_key_t, size_t>> new_keys;
+
+	std::map<std::string, reference<data::tagcategory>> tagcategory_ids;
+	for(tag_key_t const& key : keys)
+	{
+		auto tc_it(tagcategory_ids.find(key.first));
+		if(tc_it == tagcategory_ids.end())
+			tc_it = tagcategory_ids.emplace(key.first, find_add_tagcategory(txn, key.first)).first;
+
+		const reference<data::tagcategory> tagcategory_id(tc_it->second);
+
+		boost::optional<reference<data::tag>> tag_id(find_tag(txn, key.second, tagcategory_id));
+		if(tag_id)
+		{
+			result.emplace(key, *tag_id);
+			continue;
+		}
+
+		auto i_it(new_tag_i.emplace(std::make_pair(tagcategory_id.unseal(), boost::algorithm::to_lower_copy(key.second)), new_tags.size()));
+		if(i_it.second)
+		{
+			new_tags.emplace_back(data::tag({boost::none, tagcategory_id, key.second}));
+			new_aliases.emplace_back(data::tagalias({reference<data::tag>(0), tagcategory_id, key.second}));
+		}
+
+		new_keys.emplace_back(key, i_it.first->second);
+	}
+
+	if(new_tags.empty())
+		return result;
+
+	std::vector<reference<data::tag>> new_tag_ids(write_batch_with_id(txn, new_tags));
+
+	for(size_t i = 0; i < new_aliases.size(); ++i)
+		new_aliases[i].tag_id = new_tag_ids[i];
+
+	write_batch(txn, new_aliases);
+
+	for(auto const& key_i : new_keys)
+		result.emplace(key_i.first, new_tag_ids[key_i.second]);
+
+	return result;
+}
+
+reference<data::tagcategory> storage::find_add_tagcategory(std::string const& name)
+{
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+
+	reference<data::tagcategory> tagcategory_id(supermarx::find_add_tagcategory(txn, name));
+	txn.commit();
+
+	return tagcategory_id;
+}
+
+reference<data::tag> storage::find_add_tag(std::string const& name, reference<data::tagcategory> tagcategory_id)
+{
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
+
+	reference<data::tag> tag_id(supermarx::find_add_tag(txn, name, tagcategory_id));
 	txn.commit();
 
 	return tag_id;
@@ -51,24 +134,27 @@ reference<data::tag> storage::find_add_tag(std::string const& name, reference<da
 
 void storage::absorb_tagcategory(reference<data::tagcategory> src_tagcategory_id, reference<data::tagcategory> dest_tagcategory_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 	txn.prepared(conv(statement::absorb_tagcategory))
 			(src_tagcategory_id.unseal())
 			(dest_tagcategory_id.unseal()).exec();
 	txn.commit();
 }
 
+/* Full scan of the tag tree, for check_integrity */
 void check_tag_consistency(pqxx::transaction_base& txn)
 {
-	static std::string q_tags = query_gen::simple_select<qualified<data::tag>>("tag");
-	pqxx::result result_tags(txn.exec(q_tags));
+	static generated_statement q_tags = query_gen::simple_select<qualified<data::tag>>("tag");
+	pqxx::result result_tags(q_tags.prepared(txn).exec());
 
 	std::stack<reference<data::tag>> todo;
 	std::set<reference<data::tag>> tag_ids;
 	std::map<reference<data::tag>, std::vector<reference<data::tag>>> tag_tree; //tag_tree[parent] = children
+	result_reader<qualified<data::tag>> read_tag(result_tags);
 	for(pqxx::tuple const& tup : result_tags)
 	{
-		qualified<data::tag> tag = read_result<qualified<data::tag>>(tup);
+		qualified<data::tag> tag = read_tag(tup);
 
 		tag_ids.emplace(tag.id);
 		if(tag.data.parent_id)
@@ -111,35 +197,51 @@ void check_tag_consistency(pqxx::transaction_base& txn)
 	}
 }
 
+/* Checks whether tag_id is its own ancestor by walking up from its parent, which takes time in the order of the depth of the tree.
+ * Any cycle introduced by changing the parent of tag_id, or by pointing other tags at tag_id, passes through tag_id itself.
+ */
+void check_tag_cycle(pqxx::transaction_base& txn, reference<data::tag> tag_id)
+{
+	pqxx::result result(txn.prepared(conv(statement::check_tag_cycle))(tag_id.unseal()).exec());
+
+	if(result[0][0].as<bool>())
+		throw std::runtime_error(std::string("Tag tree is not consistent (cycle detected with id: ") + boost::lexical_cast<std::string>(tag_id.unseal()) + ")");
+}
+
 void storage::absorb_tag(reference<data::tag> src_tag_id, reference<data::tag> dest_tag_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 	txn.prepared(conv(statement::absorb_tag))
 			(src_tag_id.unseal())
 			(dest_tag_id.unseal()).exec();
 
-	check_tag_consistency(txn);
+	// The children of src_tag_id are now children of dest_tag_id
+	check_tag_cycle(txn, dest_tag_id);
 
 	txn.commit();
 }
 
 std::vector<qualified<data::tag>> storage::get_tags()
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
-	static std::string q = query_gen::simple_select<qualified<data::tag>>("tag");
-	pqxx::result result_tags(txn.exec(q));
+	static generated_statement q = query_gen::simple_select<qualified<data::tag>>("tag");
+	pqxx::result result_tags(q.prepared(txn).exec());
 
 	std::vector<qualified<data::tag>> result;
+	result_reader<qualified<data::tag>> read_tag(result_tags);
 	for(pqxx::tuple const& tup : result_tags)
-		result.emplace_back(read_result<qualified<data::tag>>(tup));
+		result.emplace_back(read_tag(tup));
 
 	return result;
 }
 
 void storage::bind_tag(reference<data::productclass> productclass_id, reference<data::tag> tag_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	txn.prepared(conv(statement::bind_tag))
 			(tag_id.unseal())
@@ -150,19 +252,21 @@ void storage::bind_tag(reference<data::productclass> productclass_id, reference<
 
 void storage::update_tag(reference<data::tag> tag_id, data::tag const& tag)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	if(!update_simple<data::tag>(txn, tag_id, tag))
 		throw not_found_error();
 
-	check_tag_consistency(txn);
+	check_tag_cycle(txn, tag_id);
 
 	txn.commit();
 }
 
 void storage::update_tag_set_parent(reference<data::tag> tag_id, boost::optional<reference<data::tag>> parent_tag_id)
 {
-	pqxx::work txn(conn);
+	connection_pool::handle conn(pool.checkout());
+	pqxx::work txn(*conn);
 
 	if(parent_tag_id)
 		txn.prepared(conv(statement::update_tag_set_parent))
@@ -173,7 +277,7 @@ void storage::update_tag_set_parent(reference<data::tag> tag_id, boost::optional
 				(tag_id.unseal())
 				().exec();
 
-	check_tag_consistency(txn);
+	check_tag_cycle(txn, tag_id);
 
 	txn.commit();
 }
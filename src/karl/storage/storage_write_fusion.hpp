@@ -3,12 +3,15 @@
 #include <pqxx/pqxx>
 
 #include <cstddef>
+#include <string>
 #include <vector>
 
 #include <boost/fusion/include/at.hpp>
 #include <boost/fusion/include/for_each.hpp>
 #include <boost/fusion/adapted.hpp>
 
+#include <karl/util/iso_datetime.hpp>
+
 namespace supermarx
 {
 
@@ -50,7 +53,7 @@ struct wcol<date, INVO>
 {
 	static inline void exec(INVO& invo, date const& x)
 	{
-		wcol<std::string, INVO>::exec(invo, to_string(x));
+		wcol<std::string, INVO>::exec(invo, to_pg_string(x));
 	}
 };
 
@@ -59,7 +62,7 @@ struct wcol<datetime, INVO>
 {
 	static inline void exec(INVO& invo, datetime const& x)
 	{
-		wcol<std::string, INVO>::exec(invo, to_string(x));
+		wcol<std::string, INVO>::exec(invo, to_pg_string(x));
 	}
 };
 
@@ -122,6 +125,58 @@ struct write_itr<T, INVO, size_t<T>>
 	}
 };
 
+/* Invocation collecting the fields of a row in the text format of COPY, for a pqxx::tablewriter */
+class copy_row
+{
+private:
+	std::vector<std::string>& fields;
+
+public:
+	copy_row(std::vector<std::string>& _fields)
+		: fields(_fields)
+	{}
+
+	/* Text can not contain NUL, thus this never equals a value */
+	static std::string const& null_str()
+	{
+		static const std::string s(1, '\0');
+		return s;
+	}
+
+	template<typename T>
+	void operator()(T const& x)
+	{
+		fields.emplace_back(pqxx::to_string(x));
+	}
+
+	void operator()(std::string const& x)
+	{
+		fields.emplace_back(x);
+	}
+
+	void operator()(pqxx::binarystring const& x)
+	{
+		// Hex format of bytea; the tablewriter escapes the backslash
+		static const char digits[] = "0123456789abcdef";
+
+		std::string str("\\x");
+		str.reserve(2 + 2 * x.size());
+
+		for(unsigned char c : x)
+		{
+			str.push_back(digits[c >> 4]);
+			str.push_back(digits[c & 0xf]);
+		}
+
+		fields.emplace_back(std::move(str));
+	}
+
+	void operator()()
+	{
+		fields.emplace_back(null_str());
+	}
+};
+
 } // End of detail
 
 template<typename T, typename INVO>
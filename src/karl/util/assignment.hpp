@@ -0,0 +1,44 @@
+#pragma once
+
+/* Selects the assignment solver used for textual similarity at compile time.
+ * hungarian_fast is the default; define KARL_ASSIGNMENT_JV (CMake option of the same name) to use assignment_jv.
+ * Both produce a maximum weight assignment, but may choose differently between equally good ones.
+ */
+
+#ifdef KARL_ASSIGNMENT_JV
+
+#include <karl/util/assignment_jv.hpp>
+
+namespace supermarx
+{
+
+template<typename SIMILARITY_T>
+using assignment_workspace = assignment_jv_workspace<SIMILARITY_T>;
+
+template<typename SIMILARITY_T, size_t MAX_N>
+using assignment_fixed_workspace = assignment_jv_fixed_workspace<SIMILARITY_T, MAX_N>;
+
+template<typename SIMILARITY_T, typename WORKSPACE = assignment_workspace<SIMILARITY_T>>
+using assignment_solver = assignment_jv<SIMILARITY_T, WORKSPACE>;
+
+}
+
+#else
+
+#include <karl/util/hungarian_fast.hpp>
+
+namespace supermarx
+{
+
+template<typename SIMILARITY_T>
+using assignment_workspace = hungarian_workspace<SIMILARITY_T>;
+
+template<typename SIMILARITY_T, size_t MAX_N>
+using assignment_fixed_workspace = hungarian_fixed_workspace<SIMILARITY_T, MAX_N>;
+
+template<typename SIMILARITY_T, typename WORKSPACE = assignment_workspace<SIMILARITY_T>>
+using assignment_solver = hungarian_fast<SIMILARITY_T, WORKSPACE>;
+
+}
+
+#endif
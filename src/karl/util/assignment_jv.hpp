@@ -0,0 +1,230 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <cassert>
+
+#include <karl/util/similarity_matrix.hpp>
+
+namespace supermarx
+{
+
+/* Buffers used by assignment_jv, kept between runs so that solving does not allocate once they have grown */
+template<typename SIMILARITY_T>
+class assignment_jv_workspace
+{
+public:
+	typedef SIMILARITY_T cost_e;
+
+	std::vector<cost_e> u, v, minv;
+	std::vector<size_t> p, way;
+	std::vector<bool> used;
+
+	assignment_jv_workspace()
+	: u(), v(), minv()
+	, p(), way()
+	, used()
+	{}
+
+	static bool fits(size_t)
+	{
+		return true;
+	}
+
+	void reset(size_t rows, size_t cols)
+	{
+		u.resize(rows + 1);
+		v.resize(cols + 1);
+		minv.resize(cols + 1);
+		p.resize(cols + 1);
+		way.resize(cols + 1);
+		used.resize(cols + 1);
+	}
+};
+
+/* Workspace for assignment_jv with a compile-time maximum size, stored entirely inline (e.g. on the stack) */
+template<typename SIMILARITY_T, size_t MAX_N>
+class assignment_jv_fixed_workspace
+{
+public:
+	typedef SIMILARITY_T cost_e;
+
+	std::array<cost_e, MAX_N + 1> u, v, minv;
+	std::array<size_t, MAX_N + 1> p, way;
+	std::array<bool, MAX_N + 1> used;
+
+	static bool fits(size_t n)
+	{
+		return n <= MAX_N;
+	}
+
+	void reset(size_t, size_t)
+	{}
+};
+
+/* Maximum weight assignment by shortest augmenting paths, in the style of Jonker and Volgenant.
+ * The rows of the smaller side are added one at a time; every addition is a Dijkstra search over the columns
+ * using reduced costs, which touches every column at most once. This bounds a run at O(n^2 m) regardless of ties
+ * or rounding in the costs, and the similarity matrix is read in place instead of being copied into a square matrix.
+ * Same interface as hungarian_fast.
+ */
+template<typename SIMILARITY_T, typename WORKSPACE = assignment_jv_workspace<SIMILARITY_T>>
+class assignment_jv
+{
+public:
+	typedef std::pair<size_t, size_t> coord_t;
+	typedef coord_t matching_e;
+	typedef std::vector<matching_e> matching_t;
+
+private:
+	using cost_e = typename similarity_matrix<SIMILARITY_T>::similarity;
+
+	similarity_matrix<SIMILARITY_T> const& similarity;
+
+	// Rows are the smaller side of the matrix; transposed when that is x rather than y
+	const bool transposed;
+	const size_t rows, cols;
+
+	std::unique_ptr<WORKSPACE> own_ws;
+	WORKSPACE& ws;
+
+public:
+	assignment_jv(const similarity_matrix<SIMILARITY_T>& similarity)
+	: assignment_jv(similarity, nullptr)
+	{}
+
+	/* Solves using the buffers of ws, which must fit the larger dimension of similarity */
+	assignment_jv(const similarity_matrix<SIMILARITY_T>& similarity, WORKSPACE& ws)
+	: assignment_jv(similarity, &ws)
+	{}
+
+	matching_t produce()
+	{
+		matching_t result;
+
+		produce([&](size_t y, size_t x) {
+			result.emplace_back(y, x);
+		});
+
+		return result;
+	}
+
+	/* Calls f(y, x) for every matched coordinate, in ascending order of y; does not allocate */
+	template<typename F>
+	void produce(F f)
+	{
+		find_matching();
+
+		// ws.p[j] is the 1-based row assigned to column j, or 0
+		if(transposed)
+		{
+			for(size_t j = 1; j <= cols; j++)
+				if(ws.p[j] != 0)
+					f(j - 1, ws.p[j] - 1);
+		}
+		else
+		{
+			// Every row is assigned; reuse way[] to look up the column of each row
+			for(size_t j = 1; j <= cols; j++)
+				if(ws.p[j] != 0)
+					ws.way[ws.p[j] - 1] = j - 1;
+
+			for(size_t i = 0; i < rows; i++)
+				f(i, ws.way[i]);
+		}
+	}
+
+private:
+	assignment_jv(const similarity_matrix<SIMILARITY_T>& _similarity, WORKSPACE* _ws)
+	: similarity(_similarity)
+	, transposed(_similarity.height() > _similarity.width())
+	, rows(transposed ? _similarity.width() : _similarity.height())
+	, cols(transposed ? _similarity.height() : _similarity.width())
+	, own_ws(_ws == nullptr ? new WORKSPACE() : nullptr)
+	, ws(_ws == nullptr ? *own_ws : *_ws)
+	{
+		assert(ws.fits(cols));
+		ws.reset(rows, cols);
+	}
+
+	// Minimization cost of assigning 1-based row i to 1-based column j
+	cost_e cost(const size_t i, const size_t j) const
+	{
+		return transposed ? -similarity(j - 1, i - 1) : -similarity(i - 1, j - 1);
+	}
+
+	void find_matching()
+	{
+		const cost_e inf = std::numeric_limits<cost_e>::max();
+
+		std::fill(ws.u.begin(), ws.u.begin() + rows + 1, 0);
+		std::fill(ws.v.begin(), ws.v.begin() + cols + 1, 0);
+		std::fill(ws.p.begin(), ws.p.begin() + cols + 1, 0);
+
+		for(size_t i = 1; i <= rows; i++)
+		{
+			// Column 0 is a virtual column holding the row being added
+			ws.p[0] = i;
+			size_t j0 = 0;
+
+			std::fill(ws.minv.begin(), ws.minv.begin() + cols + 1, inf);
+			std::fill(ws.used.begin(), ws.used.begin() + cols + 1, false);
+
+			//Grow the shortest path tree until it reaches an unassigned column
+			do
+			{
+				ws.used[j0] = true;
+				const size_t i0 = ws.p[j0];
+
+				cost_e delta = inf;
+				size_t j1 = 0;
+
+				for(size_t j = 1; j <= cols; j++)
+				{
+					if(ws.used[j])
+						continue;
+
+					const cost_e cur = cost(i0, j) - ws.u[i0] - ws.v[j];
+					if(cur < ws.minv[j])
+					{
+						ws.minv[j] = cur;
+						ws.way[j] = j0;
+					}
+
+					if(ws.minv[j] < delta)
+					{
+						delta = ws.minv[j];
+						j1 = j;
+					}
+				}
+
+				assert(j1 != 0);
+
+				for(size_t j = 0; j <= cols; j++)
+				{
+					if(ws.used[j])
+					{
+						ws.u[ws.p[j]] += delta;
+						ws.v[j] -= delta;
+					}
+					else
+						ws.minv[j] -= delta;
+				}
+
+				j0 = j1;
+			} while(ws.p[j0] != 0);
+
+			//Flip the assignments along the path
+			do
+			{
+				const size_t j1 = ws.way[j0];
+				ws.p[j0] = ws.p[j1];
+				j0 = j1;
+			} while(j0 != 0);
+		}
+	}
+};
+
+}
@@ -1,13 +1,97 @@
 #pragma once
 
-#include <deque>
+#include <array>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <cassert>
 
 #include <karl/util/similarity_matrix.hpp>
 
 namespace supermarx
 {
 
+/* Buffers used by hungarian_fast, kept between runs so that solving does not allocate once they have grown */
 template<typename SIMILARITY_T>
+class hungarian_workspace
+{
+public:
+	typedef SIMILARITY_T cost_e;
+
+	std::vector<size_t> xy, yx, aug_path, slackx, queue;
+	std::vector<bool> S, T;
+	std::vector<cost_e> slack;
+
+private:
+	matrix<cost_e> costs;
+
+public:
+	hungarian_workspace()
+	: xy(), yx(), aug_path(), slackx(), queue()
+	, S(), T()
+	, slack()
+	, costs(0, 0, 0)
+	{}
+
+	static bool fits(size_t)
+	{
+		return true;
+	}
+
+	void reset(size_t n)
+	{
+		costs.reset(n, n, 0);
+		xy.resize(n);
+		yx.resize(n);
+		aug_path.resize(n);
+		slackx.resize(n);
+		queue.resize(n + 1);
+		S.resize(n);
+		T.resize(n);
+		slack.resize(n);
+	}
+
+	cost_e& cost(const size_t x, const size_t y)
+	{
+		return costs(x, y);
+	}
+};
+
+/* Workspace for hungarian_fast with a compile-time maximum size, stored entirely inline (e.g. on the stack) */
+template<typename SIMILARITY_T, size_t MAX_N>
+class hungarian_fixed_workspace
+{
+public:
+	typedef SIMILARITY_T cost_e;
+
+	std::array<size_t, MAX_N> xy, yx, aug_path, slackx;
+	std::array<size_t, MAX_N + 1> queue;
+	std::array<bool, MAX_N> S, T;
+	std::array<cost_e, MAX_N> slack;
+
+private:
+	std::array<cost_e, MAX_N * MAX_N> costs;
+	size_t n;
+
+public:
+	static bool fits(size_t n)
+	{
+		return n <= MAX_N;
+	}
+
+	void reset(size_t _n)
+	{
+		n = _n;
+		std::fill(costs.begin(), costs.begin() + n * n, 0);
+	}
+
+	cost_e& cost(const size_t x, const size_t y)
+	{
+		return costs[x*n + y];
+	}
+};
+
+template<typename SIMILARITY_T, typename WORKSPACE = hungarian_workspace<SIMILARITY_T>>
 class hungarian_fast
 {
 public:
@@ -17,35 +101,69 @@ public:
 
 private:
 	using cost_e = typename similarity_matrix<SIMILARITY_T>::similarity;
-	typedef matrix<cost_e> cost_t;
+
+	static constexpr size_t none = std::numeric_limits<size_t>::max();
 
 	const size_t orig_width, orig_height, n;
 
-	cost_t cost;
+	std::unique_ptr<WORKSPACE> own_ws;
+	WORKSPACE& ws;
 
-	std::vector<boost::optional<size_t>> xy, yx, aug_path;
-	std::vector<bool> S, T;
-	std::vector<cost_e> slack;
-	std::vector<size_t> slackx;
+	size_t q_begin, q_end;
 
 public:
 	hungarian_fast(const similarity_matrix<SIMILARITY_T>& similarity)
+	: hungarian_fast(similarity, nullptr)
+	{}
+
+	/* Solves using the buffers of ws, which must fit the larger dimension of similarity */
+	hungarian_fast(const similarity_matrix<SIMILARITY_T>& similarity, WORKSPACE& ws)
+	: hungarian_fast(similarity, &ws)
+	{}
+
+	matching_t produce()
+	{
+		matching_t result;
+
+		produce([&](size_t y, size_t x) {
+			result.emplace_back(y, x);
+		});
+
+		return result;
+	}
+
+	/* Calls f(y, x) for every matched coordinate, in ascending order of y; does not allocate */
+	template<typename F>
+	void produce(F f)
+	{
+		find_matching();
+
+		for(size_t y = 0; y < orig_height; y++)
+			if(ws.xy[y] < orig_width)
+				f(y, ws.xy[y]);
+	}
+
+private:
+	hungarian_fast(const similarity_matrix<SIMILARITY_T>& similarity, WORKSPACE* _ws)
 	: orig_width(similarity.width())
 	, orig_height(similarity.height())
 	, n(std::max(orig_width, orig_height))
-	, cost(n, n, 0)
-	, xy(n, boost::none)
-	, yx(n, boost::none)
-	, aug_path()
-	, S()
-	, T()
-	, slack()
-	, slackx()
+	, own_ws(_ws == nullptr ? new WORKSPACE() : nullptr)
+	, ws(_ws == nullptr ? *own_ws : *_ws)
+	, q_begin(0)
+	, q_end(0)
 	{
+		assert(ws.fits(n));
+		ws.reset(n);
+
+		std::fill(ws.xy.begin(), ws.xy.begin() + n, none);
+		std::fill(ws.yx.begin(), ws.yx.begin() + n, none);
+
 		//Find some initial feasible vertex labeling and some initial matching
 		for(size_t x = 0; x < n; x++)
 		{
-			cost_e max = std::numeric_limits<cost_e>::min();
+			// Not below zero, as the padding rows would otherwise underflow integer costs
+			cost_e max = std::max<cost_e>(std::numeric_limits<cost_e>::min(), 0);
 
 			if(x < orig_height)
 				for(size_t y = 0; y < orig_width; y++)
@@ -60,42 +178,33 @@ public:
 		}
 	}
 
-	matching_t produce()
+	cost_e& cost(const size_t x, const size_t y)
 	{
-		matching_t result;
-
-		find_matching();
-
-		for(size_t y = 0; y < orig_height; y++)
-			if(xy[y].get() < orig_width)
-				result.emplace_back(y, xy[y].get());
-
-		return result;
+		return ws.cost(x, y);
 	}
 
-private:
 	void compute_slack(const size_t x)
 	{
 		for(size_t y = 0; y < n; y++)
 		{
-			if(cost(x, y) >= slack[y])
+			if(cost(x, y) >= ws.slack[y])
 				continue;
 
-			slack[y] = cost(x, y);
-			slackx[y] = x;
+			ws.slack[y] = cost(x, y);
+			ws.slackx[y] = x;
 		}
 	}
 
 	void assign(const size_t x, const size_t y)
 	{
-		xy[x] = y;
-		yx[y] = x;
+		ws.xy[x] = y;
+		ws.yx[y] = x;
 	}
 
 	void add_to_path(const size_t x, const size_t prevx)
 	{
-		aug_path[x] = prevx;
-		S[x] = true;
+		ws.aug_path[x] = prevx;
+		ws.S[x] = true;
 		compute_slack(x);
 	}
 
@@ -103,20 +212,20 @@ private:
 	{
 		cost_e delta = std::numeric_limits<cost_e>::max();
 		for(size_t i = 0; i < n; i++)
-			if(!T[i])
-				delta = std::min(delta, slack[i]);
+			if(!ws.T[i])
+				delta = std::min(delta, ws.slack[i]);
 
 		for(size_t i = 0; i < n; i++)
 		{
-			if(S[i])
+			if(ws.S[i])
 				for(size_t y = 0; y < n; y++)
 					cost(i, y) -= delta;
 
-			if(T[i])
+			if(ws.T[i])
 				for(size_t x = 0; x < n; x++)
 					cost(x, i) += delta;
 			else
-				slack[i] -= delta;
+				ws.slack[i] -= delta;
 		}
 	}
 
@@ -126,37 +235,47 @@ private:
 		//Flip the edges along the augmenting path
 		//This means we will add one more item to our matching
 		for(
-			boost::optional<size_t> cx(start.first), cy(start.second), ty(boost::none);
-			cx;
-			cx = aug_path[cx.get()], cy = ty
+			size_t cx(start.first), cy(start.second), ty(none);
+			cx != none;
+			cx = ws.aug_path[cx], cy = ty
 		)
 		{
-			ty = xy[cx.get()];
-			assign(cx.get(), cy.get());
+			ty = ws.xy[cx];
+			assign(cx, cy);
 		}
 	}
 
-	bool build_path_bfs(std::deque<size_t>& q, coord_t& start)
+	// The queue of x's to visit; every x is queued at most once per round, so it never exceeds n + 1 elements
+	void q_push(const size_t x)
+	{
+		ws.queue[q_end++] = x;
+	}
+
+	void q_clear()
+	{
+		q_begin = q_end = 0;
+	}
+
+	bool build_path_bfs(coord_t& start)
 	{
-		while(q.size() > 0)
+		while(q_begin < q_end)
 		{
-			const size_t x = q.front();
-			q.pop_front();
+			const size_t x = ws.queue[q_begin++];
 
 			for(size_t y = 0; y < n; y++)
-				if(!T[y] && cost(x, y) == 0)
+				if(!ws.T[y] && cost(x, y) == 0)
 				{
-					if(!yx[y])
+					if(ws.yx[y] == none)
 					{
 						start = std::make_pair(x, y);
 						return true;
 					}
 					else
 					{
-						const size_t yxy = yx[y].get();
-						T[y] = true;
+						const size_t yxy = ws.yx[y];
+						ws.T[y] = true;
 
-						q.push_back(yxy);
+						q_push(yxy);
 						add_to_path(yxy, x);
 					}
 				}
@@ -165,26 +284,26 @@ private:
 		return false;
 	}
 
-	bool enhance_path(std::deque<size_t>& q, coord_t& start)
+	bool enhance_path(coord_t& start)
 	{
 		for(size_t y = 0; y < n; y++)
-			if(!T[y] && slack[y] == 0)
+			if(!ws.T[y] && ws.slack[y] == 0)
 			{
-				if(!yx[y]) //Exposed vertex found; augmenting path exists
+				if(ws.yx[y] == none) //Exposed vertex found; augmenting path exists
 				{
-					start = std::make_pair(slackx[y], y);
+					start = std::make_pair(ws.slackx[y], y);
 					return true;
 				}
 				else
 				{
-					const size_t yxy = yx[y].get();
-					T[y] = true;
+					const size_t yxy = ws.yx[y];
+					ws.T[y] = true;
 
-					if(S[yxy])
+					if(ws.S[yxy])
 						continue;
 
-					q.push_back(yxy);
-					add_to_path(yxy, slackx[y]);
+					q_push(yxy);
+					add_to_path(yxy, ws.slackx[y]);
 				}
 			}
 
@@ -195,23 +314,22 @@ private:
 	{
 		for(size_t match_round = 0; match_round < n; match_round++)
 		{
-			std::deque<size_t> q; //Set of unmatched x's
+			q_clear(); //Set of unmatched x's
 
-			S.assign(n, false);
-			T.assign(n, false);
+			std::fill(ws.S.begin(), ws.S.begin() + n, false);
+			std::fill(ws.T.begin(), ws.T.begin() + n, false);
 
-			slack.assign(n, std::numeric_limits<cost_e>::max());
-			slackx.resize(n);
-			aug_path.assign(n, boost::none);
+			std::fill(ws.slack.begin(), ws.slack.begin() + n, std::numeric_limits<cost_e>::max());
+			std::fill(ws.aug_path.begin(), ws.aug_path.begin() + n, none);
 
 			//Find the first element to start the bfs for
 			for(size_t x = 0; x < n; x++)
 			{
-				if(xy[x]) //If x is matched, skip
+				if(ws.xy[x] != none) //If x is matched, skip
 					continue;
 
-				q.push_back(x);
-				S[x] = true;
+				q_push(x);
+				ws.S[x] = true;
 				compute_slack(x);
 				break;
 			}
@@ -220,13 +338,13 @@ private:
 
 			do
 			{
-				if(build_path_bfs(q, start))
+				if(build_path_bfs(start))
 					break;
 
 				update_labels();
-				q.clear();
+				q_clear();
 
-			} while(!enhance_path(q, start));
+			} while(!enhance_path(start));
 
 			flip_edges(start);
 		}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include <supermarx/datetime.hpp>
+
+namespace supermarx
+{
+	namespace detail
+	{
+		inline bool iso_digits(const char* s, size_t n, int& x)
+		{
+			x = 0;
+			for(size_t i = 0; i < n; ++i)
+			{
+				const unsigned d = static_cast<unsigned char>(s[i]) - '0';
+				if(d > 9)
+					return false;
+
+				x = x * 10 + static_cast<int>(d);
+			}
+
+			return true;
+		}
+
+		inline bool iso_date_fields(const char* s, int& y, int& m, int& d)
+		{
+			return
+				iso_digits(s, 4, y) && s[4] == '-' &&
+				iso_digits(s + 5, 2, m) && s[7] == '-' &&
+				iso_digits(s + 8, 2, d) &&
+				m >= 1 && m <= 12 && d >= 1 && d <= 31;
+		}
+
+		inline char* iso_write_digits(char* out, unsigned x, size_t n)
+		{
+			for(size_t i = n; i > 0; --i)
+			{
+				out[i-1] = static_cast<char>('0' + x % 10);
+				x /= 10;
+			}
+
+			return out + n;
+		}
+	}
+
+	/* Parses the ISO 8601 output of PostgreSQL for a date column ("YYYY-MM-DD") without allocating.
+	 * Returns false for anything else, such as infinity or BC dates, which should be left to to_date.
+	 */
+	inline bool parse_iso_date(const char* s, size_t n, date& result)
+	{
+		int y, m, d;
+		if(n != 10 || !detail::iso_date_fields(s, y, m, d))
+			return false;
+
+		result = date(y, m, d);
+		return true;
+	}
+
+	/* As parse_iso_date, for a timestamp without time zone: "YYYY-MM-DD HH:MM:SS", optionally followed by up to six fractional digits */
+	inline bool parse_iso_datetime(const char* s, size_t n, datetime& result)
+	{
+		int y, m, d, hh, mm, ss;
+		if(
+			n < 19 || !detail::iso_date_fields(s, y, m, d) ||
+			(s[10] != ' ' && s[10] != 'T') ||
+			!detail::iso_digits(s + 11, 2, hh) || s[13] != ':' ||
+			!detail::iso_digits(s + 14, 2, mm) || s[16] != ':' ||
+			!detail::iso_digits(s + 17, 2, ss) ||
+			hh > 23 || mm > 59 || ss > 59
+		)
+			return false;
+
+		int64_t us = 0;
+		if(n > 19)
+		{
+			const size_t digits = n - 20;
+			int fraction;
+			if(s[19] != '.' || digits == 0 || digits > 6 || !detail::iso_digits(s + 20, digits, fraction))
+				return false;
+
+			us = fraction;
+			for(size_t i = digits; i < 6; ++i)
+				us *= 10;
+		}
+
+		result = datetime(date(y, m, d), boost::posix_time::hours(hh) + boost::posix_time::minutes(mm) + boost::posix_time::seconds(ss) + boost::posix_time::microseconds(us));
+		return true;
+	}
+
+	/* Formats as "YYYY-MM-DD HH:MM:SS[.ffffff]", the way PostgreSQL outputs a timestamp itself.
+	 * Special values and years outside of 0-9999 fall back to to_string.
+	 */
+	inline std::string to_pg_string(datetime const& x)
+	{
+		if(x.is_special())
+			return to_string(x);
+
+		const date d(x.date());
+		const boost::posix_time::time_duration t(x.time_of_day());
+
+		if(d.year() > 9999)
+			return to_string(x);
+
+		const int64_t us = t.total_microseconds() % 1000000;
+
+		char buf[26];
+		char* p = buf;
+		p = detail::iso_write_digits(p, d.year(), 4); *p++ = '-';
+		p = detail::iso_write_digits(p, d.month(), 2); *p++ = '-';
+		p = detail::iso_write_digits(p, d.day(), 2); *p++ = ' ';
+		p = detail::iso_write_digits(p, static_cast<unsigned>(t.hours()), 2); *p++ = ':';
+		p = detail::iso_write_digits(p, static_cast<unsigned>(t.minutes()), 2); *p++ = ':';
+		p = detail::iso_write_digits(p, static_cast<unsigned>(t.seconds()), 2);
+
+		if(us != 0)
+		{
+			*p++ = '.';
+			p = detail::iso_write_digits(p, static_cast<unsigned>(us), 6);
+		}
+
+		return std::string(buf, p);
+	}
+
+	inline std::string to_pg_string(date const& x)
+	{
+		if(x.is_special() || x.year() > 9999)
+			return to_string(x);
+
+		char buf[10];
+		char* p = buf;
+		p = detail::iso_write_digits(p, x.year(), 4); *p++ = '-';
+		p = detail::iso_write_digits(p, x.month(), 2); *p++ = '-';
+		p = detail::iso_write_digits(p, x.day(), 2);
+
+		return std::string(buf, p);
+	}
+}
@@ -1,51 +1,232 @@
 #pragma once
 
 #include <string>
-#include <memory>
-#include <numeric>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
 
 namespace supermarx
 {
-	inline static size_t levenshtein(std::string const& x, std::string const& y)
+	namespace detail
+	{
+		/* Bit-parallel edit distance (Myers 1999, in the block-based formulation of Hyyrö 2003).
+		 * Column j of the dynamic programming matrix is encoded as vertical deltas: bit i of vp (vn) is set
+		 * if cell i differs by +1 (-1) from cell i-1. Patterns longer than 64 bytes span multiple 64-bit words.
+		 * pm must hold 256 * words entries, and be zero for every character occurring in x or y.
+		 */
+		inline size_t levenshtein_myers(const char* x, const size_t m, const char* y, const size_t n, uint64_t* pm, uint64_t* vp, uint64_t* vn)
+		{
+			const size_t words = (m + 63) / 64;
+			const uint64_t last = uint64_t(1) << ((m - 1) % 64);
+
+			for(size_t i = 0; i < m; ++i)
+				pm[static_cast<unsigned char>(x[i]) * words + i / 64] |= uint64_t(1) << (i % 64);
+
+			std::fill(vp, vp + words, ~uint64_t(0));
+			std::fill(vn, vn + words, uint64_t(0));
+
+			size_t distance = m;
+			for(size_t j = 0; j < n; ++j)
+			{
+				const uint64_t* pm_j = pm + static_cast<unsigned char>(y[j]) * words;
+				uint64_t hp_carry = 1;
+				uint64_t hn_carry = 0;
+
+				for(size_t w = 0; w < words; ++w)
+				{
+					const uint64_t xv = pm_j[w] | hn_carry;
+					const uint64_t d0 = (((xv & vp[w]) + vp[w]) ^ vp[w]) | xv | vn[w];
+
+					uint64_t hp = vn[w] | ~(d0 | vp[w]);
+					uint64_t hn = d0 & vp[w];
+
+					const uint64_t hp_carry_in = hp_carry;
+					const uint64_t hn_carry_in = hn_carry;
+
+					if(w + 1 < words)
+					{
+						hp_carry = hp >> 63;
+						hn_carry = hn >> 63;
+					}
+					else
+					{
+						hp_carry = (hp & last) ? 1 : 0;
+						hn_carry = (hn & last) ? 1 : 0;
+					}
+
+					hp = (hp << 1) | hp_carry_in;
+					hn = (hn << 1) | hn_carry_in;
+
+					vp[w] = hn | ~(d0 | hp);
+					vn[w] = hp & d0;
+				}
+
+				distance += hp_carry;
+				distance -= hn_carry;
+			}
+
+			return distance;
+		}
+
+		/* Single-word specialisation of the above for patterns of at most 64 bytes */
+		inline size_t levenshtein_myers64(const char* x, const size_t m, const char* y, const size_t n, uint64_t* pm)
+		{
+			const uint64_t last = uint64_t(1) << (m - 1);
+
+			for(size_t i = 0; i < m; ++i)
+				pm[static_cast<unsigned char>(x[i])] |= uint64_t(1) << i;
+
+			uint64_t vp = ~uint64_t(0);
+			uint64_t vn = 0;
+
+			size_t distance = m;
+			for(size_t j = 0; j < n; ++j)
+			{
+				const uint64_t xv = pm[static_cast<unsigned char>(y[j])] | vn;
+				const uint64_t xh = (((xv & vp) + vp) ^ vp) | xv;
+
+				uint64_t hp = vn | ~(xh | vp);
+				uint64_t hn = vp & xh;
+
+				distance += (hp & last) ? 1 : 0;
+				distance -= (hn & last) ? 1 : 0;
+
+				hp = (hp << 1) | 1;
+				hn = hn << 1;
+
+				vp = hn | ~(xv | hp);
+				vn = hp & xv;
+			}
+
+			return distance;
+		}
+
+		template<typename F>
+		inline void levenshtein_clear_pm(const char* x, const size_t m, const char* y, const size_t n, const size_t words, F f)
+		{
+			for(size_t i = 0; i < m; ++i)
+				f(static_cast<unsigned char>(x[i]) * words);
+
+			for(size_t j = 0; j < n; ++j)
+				f(static_cast<unsigned char>(y[j]) * words);
+		}
+	}
+
+	/* Edit distance between the bytes of x and y.
+	 * Uses a single machine word when the shorter of both fits in 64 bytes, and the blocked variant otherwise.
+	 * The single-word variant works on the stack; the blocked variant reuses thread-local buffers, which only grow.
+	 */
+	inline static size_t levenshtein(const char* x, size_t m, const char* y, size_t n)
 	{
-		const size_t m(x.size());
-		const size_t n(y.size());
+		if(m > n)
+		{
+			std::swap(x, y);
+			std::swap(m, n);
+		}
 
 		if(m == 0)
 			return n;
 
-		if(n == 0)
-			return m;
+		if(m <= 64)
+		{
+			uint64_t pm[256];
 
-		std::vector<size_t> costs(n+1);
-		std::iota(costs.begin(), costs.end(), 0);
+			detail::levenshtein_clear_pm(x, m, y, n, 1, [&](size_t i) { pm[i] = 0; });
+			return detail::levenshtein_myers64(x, m, y, n, pm);
+		}
 
-		for(size_t i = 0; i < m; ++i)
+		const size_t words = (m + 63) / 64;
+
+		thread_local std::vector<uint64_t> pm, vp, vn;
+		if(pm.size() < 256 * words)
 		{
-			char cx = x.at(i);
+			pm.assign(256 * words, 0);
+			vp.resize(words);
+			vn.resize(words);
+		}
 
-			costs[0] = i+1;
-			size_t corner = i;
+		size_t result = detail::levenshtein_myers(x, m, y, n, pm.data(), vp.data(), vn.data());
 
-			for(size_t j = 0; j < n; ++j)
+		// Leave the pattern table zeroed for the next call
+		detail::levenshtein_clear_pm(x, m, y, n, words, [&](size_t i) { std::fill(pm.data() + i, pm.data() + i + words, 0); });
+
+		return result;
+	}
+
+	inline static size_t levenshtein(std::string const& x, std::string const& y)
+	{
+		return levenshtein(x.data(), x.size(), y.data(), y.size());
+	}
+
+	/* Edit distance between x and y if it is at most max_distance, and max_distance + 1 otherwise.
+	 * Only the diagonal band of width 2 * max_distance + 1 is computed (Ukkonen), and the computation stops
+	 * as soon as every cell of a row exceeds the bound.
+	 */
+	inline static size_t levenshtein_bounded(const char* x, size_t m, const char* y, size_t n, const size_t max_distance)
+	{
+		static constexpr size_t max_band_distance = 64;
+
+		if(m > n)
+		{
+			std::swap(x, y);
+			std::swap(m, n);
+		}
+
+		const size_t k = max_distance;
+		const size_t exceeded = k + 1;
+
+		if(n - m > k)
+			return exceeded;
+
+		if(k >= n || k > max_band_distance)
+			return std::min(levenshtein(x, m, y, n), exceeded);
+
+		// band[d] holds the cell of the current row on diagonal d - k, i.e. column j = i + d - k
+		size_t band[2 * max_band_distance + 2];
+		const size_t width = 2 * k + 1;
+
+		for(size_t d = 0; d < width; ++d)
+			band[d] = (d < k) ? exceeded : d - k;
+
+		band[width] = exceeded;
+
+		for(size_t i = 1; i <= m; ++i)
+		{
+			size_t left = exceeded;
+			size_t row_min = exceeded;
+
+			for(size_t d = 0; d < width; ++d)
 			{
-				char cy = y.at(j);
-				size_t upper = costs.at(j+1);
+				const size_t j = i + d; // Offset by k, to stay unsigned
+				size_t cell;
 
-				if(cx == cy)
-					costs.at(j+1) = corner;
+				if(j < k || j > n + k)
+					cell = exceeded;
+				else if(j == k)
+					cell = i;
 				else
 				{
-					size_t t(upper < corner ? upper : corner);
-					costs.at(j+1) = (costs.at(j) < t ? costs.at(j) : t) + 1;
+					const size_t diagonal = band[d] + (x[i-1] == y[j-k-1] ? 0 : 1);
+					const size_t up = band[d+1] + 1;
+
+					cell = std::min(std::min(diagonal, up), left + 1);
 				}
 
-				corner = upper;
+				cell = std::min(cell, exceeded);
+				band[d] = cell;
+				left = cell;
+				row_min = std::min(row_min, cell);
 			}
+
+			if(row_min > k)
+				return exceeded;
 		}
 
-		size_t result = costs[n];
+		return band[n - m + k];
+	}
 
-		return result;
+	inline static size_t levenshtein_bounded(std::string const& x, std::string const& y, const size_t max_distance)
+	{
+		return levenshtein_bounded(x.data(), x.size(), y.data(), y.size(), max_distance);
 	}
 }
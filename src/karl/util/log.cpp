@@ -1,6 +1,7 @@
 #include <karl/util/log.hpp>
 
 #include <iostream>
+#include <mutex>
 #include <ctime>
 
 namespace supermarx
@@ -14,6 +15,10 @@ log::log(const std::string& _facility, const level_e _l)
 
 log::~log()
 {
+	// Keep lines written from different threads whole
+	static std::mutex m;
+	std::lock_guard<std::mutex> lock(m);
+
 	std::cerr << os.str() << std::endl;
 }
 
@@ -21,7 +26,9 @@ std::ostream& log::operator()()
 {
 	char time_str[80];
 	std::time_t t = std::time(NULL);
-	std::strftime(time_str, 80, "%F %T", std::localtime(&t));
+	std::tm tm;
+	localtime_r(&t, &tm); // std::localtime shares its result between threads
+	std::strftime(time_str, 80, "%F %T", &tm);
 
 	os << time_str << " [" << facility << "] " << to_string(l) << ": ";
 	return os;
@@ -6,6 +6,7 @@
 namespace supermarx
 {
 
+/* Collects a single log line, which is written to stderr on destruction. Lines may be logged from any thread. */
 class log
 {
 public:
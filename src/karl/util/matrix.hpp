@@ -9,7 +9,7 @@ template<typename T>
 class matrix
 {
 public:
-	const size_t size_i, size_j;
+	size_t size_i, size_j;
 
 private:
 	std::vector<T> data;
@@ -21,6 +21,14 @@ public:
 	, data(size_i * size_j, default_value)
 	{}
 
+	/* Reshapes the matrix and resets all elements, reusing the allocated storage where possible */
+	void reset(const size_t _size_i, const size_t _size_j, const T default_value)
+	{
+		size_i = _size_i;
+		size_j = _size_j;
+		data.assign(size_i * size_j, default_value);
+	}
+
 	T& operator()(const size_t i, const size_t j)
 	{
 		return data[i*size_j + j];
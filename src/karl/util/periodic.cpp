@@ -0,0 +1,40 @@
+#include <karl/util/periodic.hpp>
+
+namespace supermarx
+{
+
+periodic::periodic(task_t _f, std::chrono::milliseconds _interval)
+	: f(_f)
+	, interval(_interval)
+	, m()
+	, cv_stop()
+	, stopping(false)
+	, runner()
+{
+	runner = std::thread([this]() { run(); });
+}
+
+periodic::~periodic()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+	}
+
+	cv_stop.notify_all();
+	runner.join();
+}
+
+void periodic::run()
+{
+	std::unique_lock<std::mutex> lock(m);
+
+	while(!cv_stop.wait_for(lock, interval, [&]() { return stopping; }))
+	{
+		lock.unlock();
+		f();
+		lock.lock();
+	}
+}
+
+}
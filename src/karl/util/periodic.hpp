@@ -0,0 +1,41 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace supermarx
+{
+
+/* Calls a function every interval on a thread of its own, until destroyed.
+ * The destructor waits for a call in progress, but does not make a last call.
+ */
+class periodic
+{
+public:
+	typedef std::function<void()> task_t;
+
+private:
+	const task_t f;
+	const std::chrono::milliseconds interval;
+
+	std::mutex m;
+	std::condition_variable cv_stop;
+	bool stopping;
+
+	std::thread runner;
+
+	void run();
+
+public:
+	periodic(periodic&) = delete;
+	void operator=(periodic&) = delete;
+
+	/* f must not throw */
+	periodic(task_t f, std::chrono::milliseconds interval);
+	~periodic();
+};
+
+}
@@ -19,6 +19,11 @@ public:
 	: data(height, width, default_value)
 	{}
 
+	void reset(const size_t height, const size_t width, const similarity default_value = 0)
+	{
+		data.reset(height, width, default_value);
+	}
+
 	similarity& operator()(const size_t y, const size_t x)
 	{
 		return data(y, x);
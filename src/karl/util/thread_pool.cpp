@@ -0,0 +1,116 @@
+#include <karl/util/thread_pool.hpp>
+
+namespace supermarx
+{
+
+thread_pool::thread_pool(size_t size)
+	: queues()
+	, threads()
+	, m()
+	, cv_work()
+	, queued(0)
+	, next_queue(0)
+	, stopping(false)
+{
+	if(size == 0)
+		size = std::max(1u, std::thread::hardware_concurrency());
+
+	for(size_t i = 0; i < size; ++i)
+		queues.emplace_back(new worker_queue());
+
+	for(size_t i = 0; i < size; ++i)
+		threads.emplace_back([this, i]() { run(i); });
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+	}
+
+	cv_work.notify_all();
+
+	for(std::thread& t : threads)
+		t.join();
+}
+
+size_t thread_pool::size() const
+{
+	return queues.size();
+}
+
+void thread_pool::post(task_t task)
+{
+	// Counted before it is published, such that a worker that pops it right away never takes queued below zero.
+	// A worker woken in between finds no task yet, and retries until the push below lands.
+	size_t i;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		i = next_queue++ % queues.size();
+		++queued;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queues[i]->m);
+		queues[i]->tasks.emplace_back(std::move(task));
+	}
+
+	cv_work.notify_one();
+}
+
+bool thread_pool::try_pop(size_t i, task_t& task)
+{
+	{
+		worker_queue& q(*queues[i]);
+		std::lock_guard<std::mutex> lock(q.m);
+
+		if(!q.tasks.empty())
+		{
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+
+	for(size_t k = 1; k < queues.size(); ++k)
+	{
+		worker_queue& q(*queues[(i + k) % queues.size()]);
+		std::lock_guard<std::mutex> lock(q.m);
+
+		if(!q.tasks.empty())
+		{
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void thread_pool::run(size_t i)
+{
+	while(true)
+	{
+		task_t task;
+		if(try_pop(i, task))
+		{
+			{
+				std::lock_guard<std::mutex> lock(m);
+				--queued;
+			}
+
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m);
+		cv_work.wait(lock, [&]() { return stopping || queued > 0; });
+
+		if(stopping && queued == 0)
+			return;
+	}
+}
+
+}
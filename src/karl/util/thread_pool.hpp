@@ -0,0 +1,105 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace supermarx
+{
+
+/* Fixed-size pool of worker threads with work-stealing.
+ * Every worker owns a queue; posted tasks are spread round-robin over these queues.
+ * A worker takes tasks from the front of its own queue, and steals from the back of the other queues when it runs dry.
+ */
+class thread_pool
+{
+public:
+	typedef std::function<void()> task_t;
+
+private:
+	struct worker_queue
+	{
+		std::mutex m;
+		std::deque<task_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<worker_queue>> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex m;
+	std::condition_variable cv_work;
+	size_t queued;
+	size_t next_queue;
+	bool stopping;
+
+	bool try_pop(size_t i, task_t& task);
+	void run(size_t i);
+
+public:
+	thread_pool(thread_pool&) = delete;
+	void operator=(thread_pool&) = delete;
+
+	/* Starts the given number of workers, or one per hardware thread when 0 */
+	thread_pool(size_t size = 0);
+
+	/* Finishes all tasks still queued before joining the workers */
+	~thread_pool();
+
+	size_t size() const;
+
+	/* Tasks must not throw; use parallel_for for work that can fail */
+	void post(task_t task);
+
+	/* Calls f(i) for every i in [0, n) using the workers, and blocks until all calls have returned.
+	 * The first exception thrown by f is rethrown after all calls have finished.
+	 */
+	template<typename F>
+	void parallel_for(size_t n, F f)
+	{
+		const size_t chunks = std::min(n, size() * 8);
+		if(chunks == 0)
+			return;
+
+		std::mutex done_m;
+		std::condition_variable done_cv;
+		size_t done = 0;
+		std::exception_ptr error;
+
+		for(size_t c = 0; c < chunks; ++c)
+		{
+			const size_t begin = n * c / chunks;
+			const size_t end = n * (c+1) / chunks;
+
+			post([&, begin, end]()
+			{
+				try
+				{
+					for(size_t i = begin; i < end; ++i)
+						f(i);
+				} catch( ... )
+				{
+					std::lock_guard<std::mutex> lock(done_m);
+					if(!error)
+						error = std::current_exception();
+				}
+
+				std::lock_guard<std::mutex> lock(done_m);
+				if(++done == chunks)
+					done_cv.notify_all();
+			});
+		}
+
+		std::unique_lock<std::mutex> lock(done_m);
+		done_cv.wait(lock, [&]() { return done == chunks; });
+
+		if(error)
+			std::rethrow_exception(error);
+	}
+};
+
+}
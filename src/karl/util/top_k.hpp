@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+namespace supermarx
+{
+
+/* Keeps the k greatest of a stream of values, in descending order.
+ * GREATER must be a strict weak ordering; of equal values the one pushed first is kept first.
+ * Meant for small k: a push costs O(k) at worst, and values that can not enter are rejected with a single comparison.
+ */
+template<typename T, typename GREATER>
+class top_k
+{
+private:
+	size_t k;
+	GREATER greater;
+	std::vector<T> items;
+
+public:
+	top_k(size_t _k, GREATER _greater = GREATER())
+	: k(_k)
+	, greater(_greater)
+	, items()
+	{
+		items.reserve(k + 1);
+	}
+
+	bool empty() const
+	{
+		return items.empty();
+	}
+
+	bool full() const
+	{
+		return items.size() >= k;
+	}
+
+	/* The least value kept; a value has to be greater than this to enter once full */
+	T const& back() const
+	{
+		return items.back();
+	}
+
+	bool push(T x)
+	{
+		if(k == 0 || (full() && !greater(x, items.back())))
+			return false;
+
+		items.insert(std::upper_bound(items.begin(), items.end(), x, greater), std::move(x));
+
+		if(items.size() > k)
+			items.pop_back();
+
+		return true;
+	}
+
+	std::vector<T> const& values() const
+	{
+		return items;
+	}
+
+	std::vector<T> release()
+	{
+		return std::move(items);
+	}
+};
+
+}